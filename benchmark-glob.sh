@@ -0,0 +1,30 @@
+#!/bin/bash
+
+# Time spent by the minishell expanding filename patterns in a directory of
+# 500000 entries, generated in a temporary directory. Every pattern is matched
+# against all the entries, while only some of them match, so the command line
+# stays under the argument size limit. Usage: ./benchmark-glob.sh [entries]
+
+ENTRIES=${1:-500000}
+MINISHELL=$(realpath ./minishell)
+TREE=$(mktemp -d)
+
+trap 'rm -rf "$TREE"' EXIT
+
+if [ ! -x ./minishell ]; then
+    ./compile.sh || exit 1
+fi
+
+# One entry out of a hundred is a log file
+(cd "$TREE" && seq 1 "$ENTRIES" | awk '{ print "entry" $1 ($1 % 100 == 0 ? ".log" : ".txt") }' | xargs touch)
+
+printf "%-16s %10s %10s\n" "pattern" "matches" "seconds"
+
+for pattern in '*.log' 'entry1234?.txt' 'entry[0-4]*0.log' '*[!t]'; do
+    start=$(date +%s.%N)
+    matches=$(cd "$TREE" && printf 'echo %s | wc -w\n' "$pattern" | "$MINISHELL" 2> /dev/null | tr -cd '0-9')
+    end=$(date +%s.%N)
+
+    awk -v pattern="$pattern" -v matches="$matches" -v start="$start" -v end="$end" \
+        'BEGIN { printf "%-16s %10s %10.3f\n", pattern, matches, end - start }'
+done
@@ -0,0 +1,31 @@
+#!/bin/bash
+
+# Time spent by the minishell on a loop whose body assigns the loop variable,
+# against the same assignments written as separate lines with their values
+# already expanded. Usage: ./benchmark-loops.sh [iterations]
+
+ITERATIONS=${1:-100000}
+SCRIPT=$(mktemp)
+
+trap 'rm -f "$SCRIPT"' EXIT
+
+if [ ! -x ./minishell ]; then
+    ./compile.sh || exit 1
+fi
+
+printf "%-10s %10s\n" "script" "seconds"
+
+for script in loop lines; do
+    if [ "$script" = loop ]; then
+        printf 'for i in $(seq 1 %s); do X=$i; done\n' "$ITERATIONS"
+    else
+        seq 1 "$ITERATIONS" | sed 's/^/X=/'
+    fi > "$SCRIPT"
+
+    start=$(date +%s.%N)
+    ./minishell < "$SCRIPT" > /dev/null
+    end=$(date +%s.%N)
+
+    awk -v script="$script" -v start="$start" -v end="$end" \
+        'BEGIN { printf "%-10s %10.3f\n", script, end - start }'
+done
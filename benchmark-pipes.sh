@@ -0,0 +1,21 @@
+#!/bin/bash
+
+# Throughput of a `dd | cat | wc -c` pipeline run by the minishell for several
+# pipe capacities. Usage: ./benchmark-pipes.sh [MiB per run]
+
+MEBIBYTES=${1:-2048}
+
+if [ ! -x ./minishell ]; then
+    ./compile.sh || exit 1
+fi
+
+printf "%-10s %10s %12s\n" "pipesize" "seconds" "MiB/s"
+
+for size in 0 65536 262144 1048576 max; do
+    start=$(date +%s.%N)
+    printf 'pipesize %s\ndd if=/dev/zero bs=1M count=%s status=none | cat | wc -c\n' "$size" "$MEBIBYTES" | ./minishell > /dev/null
+    end=$(date +%s.%N)
+
+    awk -v size="$size" -v start="$start" -v end="$end" -v mebibytes="$MEBIBYTES" \
+        'BEGIN { printf "%-10s %10.3f %12.1f\n", size, end - start, mebibytes / (end - start) }'
+done
@@ -0,0 +1,29 @@
+#!/bin/bash
+
+# Time spent by the minishell on scripts whose lines are found in the plan
+# cache against scripts whose lines are all new, which are parsed and resolved
+# in `PATH` as if there were no cache. Usage: ./benchmark-plans.sh [lines]
+
+LINES=${1:-100000}
+SCRIPT=$(mktemp)
+
+trap 'rm -f "$SCRIPT"' EXIT
+
+if [ ! -x ./minishell ]; then
+    ./compile.sh || exit 1
+fi
+
+printf "%-10s %10s %10s\n" "distinct" "cached" "seconds"
+
+for distinct in 1 1000 10000 "$LINES"; do
+    for ((line = 0; line < LINES; line++)); do
+        printf 'X=%s\n' $((line % distinct))
+    done > "$SCRIPT"
+
+    start=$(date +%s.%N)
+    ./minishell < "$SCRIPT" > /dev/null
+    end=$(date +%s.%N)
+
+    awk -v distinct="$distinct" -v lines="$LINES" -v start="$start" -v end="$end" \
+        'BEGIN { printf "%-10s %9.1f%% %10.3f\n", distinct, 100 * (lines - distinct) / lines, end - start }'
+done
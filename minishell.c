@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -7,6 +9,18 @@
 #include <string.h>
 #include <signal.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <termios.h>
+#include <sys/signalfd.h>
 
 #include "parser.h"
 
@@ -16,11 +30,82 @@
  */
 #define MAXIMUM_LINE_LENGTH 1024
 
+/**
+ * Initial capacity of the buffer where a command line is expanded. It grows as
+ * needed, so substitutions may produce any amount of output.
+ */
+#define EXPANSION_BUFFER_SIZE 4096
+
 /**
  * Text string for the command line prompt when waiting for user input.
  */
 #define PROMPT "msh> "
 
+/**
+ * Text string for the prompt when waiting for the following lines of a
+ * here-document or a compound command.
+ */
+#define CONTINUATION_PROMPT "> "
+
+/**
+ * Character separating the commands of a command line that are run one after
+ * the other.
+ */
+#define SEPARATOR ';'
+
+/**
+ * Character sending a command line to the background, which also ends it.
+ */
+#define BACKGROUND '&'
+
+/**
+ * Type of node representing a command line.
+ */
+#define COMMAND_NODE 0
+
+/**
+ * Type of node representing a `for NAME in WORDS` loop.
+ */
+#define FOR_NODE 1
+
+/**
+ * Type of node representing a `while CONDITION` loop.
+ */
+#define WHILE_NODE 2
+
+/**
+ * Type of node representing an `if CONDITION` conditional.
+ */
+#define IF_NODE 3
+
+/**
+ * Variable holding the exit status of the last command line.
+ */
+#define STATUS "?"
+
+/**
+ * Offset added to the number of the signal that terminated a command to build
+ * its exit status.
+ */
+#define SIGNAL_STATUS 128
+
+/**
+ * Operator introducing a here-document, whose body is made of the following
+ * lines up to the delimiter word.
+ */
+#define HEREDOC "<<"
+
+/**
+ * Operator introducing a here-string, whose body is the following word.
+ */
+#define HERESTRING "<<<"
+
+/**
+ * File descriptor value meaning a command line has no here-document or
+ * here-string feeding its standard input.
+ */
+#define NO_INPUT -1
+
 /**
  * Result code for the child process in a fork operation.
  */
@@ -60,11 +145,116 @@
  */
 #define PIPE_WRITE 1
 
+/**
+ * Pipe capacity value meaning the kernel default size (usually 64 KiB) is
+ * kept and `F_SETPIPE_SZ` is not requested.
+ */
+#define DEFAULT_PIPE_SIZE 0
+
+/**
+ * Kernel file holding the largest capacity an unprivileged process can
+ * request for a pipe through `F_SETPIPE_SZ`.
+ */
+#define PIPE_MAXIMUM_SIZE_FILE "/proc/sys/fs/pipe-max-size"
+
+/**
+ * Argument to the `pipesize` command that selects the largest pipe capacity
+ * allowed by the kernel.
+ */
+#define PIPE_MAXIMUM_SIZE "max"
+
+/**
+ * Index representing the size part of an argument array.
+ */
+#define SIZE 1
+
+/**
+ * Index representing the buffering mode part of an argument array.
+ */
+#define BUFFER_MODE 1
+
+/**
+ * Index representing the socket path part of an argument array.
+ */
+#define ENDPOINT 1
+
 /**
  * Environment variable representing the user's home directory.
  */
 #define HOME "HOME"
 
+/**
+ * Initial number of slots of the variable store. It must be a power of two so
+ * that hashes can be mapped to slots with a mask.
+ */
+#define VARIABLE_STORE_CAPACITY 64
+
+/**
+ * Initial number of slots of the command plan cache. It must be a power of two
+ * so that hashes can be mapped to slots with a mask. The cache doubles once
+ * half of the slots are used.
+ */
+#define PLAN_CACHE_CAPACITY 512
+
+/**
+ * Largest number of slots of the command plan cache. Once reached, plans not
+ * used since the previous eviction are removed instead of growing the cache.
+ */
+#define MAXIMUM_PLAN_CACHE_CAPACITY 65536
+
+/**
+ * Initial capacity of the word list of a `for` loop, which doubles as the
+ * words are expanded.
+ */
+#define FOR_WORDS_CAPACITY 16
+
+/**
+ * Characters that make an argument a filename pattern to be expanded.
+ */
+#define WILDCARDS "*?["
+
+/**
+ * Characters at which the result of an expansion is split into words.
+ */
+#define BLANKS " \t\n"
+
+/**
+ * Size of the buffer directory entries are read into when expanding filename
+ * patterns. Large directories are read in a few system calls.
+ */
+#define DIRECTORY_BUFFER_SIZE 262144
+
+/**
+ * Type of pattern symbol matching the given character.
+ */
+#define LITERAL_SYMBOL 0
+
+/**
+ * Type of pattern symbol matching any character (`?`).
+ */
+#define ANY_SYMBOL 1
+
+/**
+ * Type of pattern symbol matching any string, including the empty one (`*`).
+ */
+#define STAR_SYMBOL 2
+
+/**
+ * Type of pattern symbol matching a character of a set (`[...]`).
+ */
+#define CLASS_SYMBOL 3
+
+/**
+ * Environment variable holding the directories where commands are searched.
+ */
+#define PATH "PATH"
+
+/**
+ * Character separating the name and the value of a variable in assignments
+ * and environment entries.
+ */
+#define ASSIGNMENT '='
+
 /**
  * Index representing the command part of an argument array.
  */
@@ -102,7 +292,197 @@
 /**
  * Maximum size allowed for the list of active jobs in the shell.
  */
-#define MAXIMUM_JOB_LIST_SIZE 50
+#define MAXIMUM_JOB_LIST_SIZE 1024
+
+/**
+ * Mode in which the standard output and error of background jobs are written
+ * straight to the terminal.
+ */
+#define JOB_OUTPUT_OFF 0
+
+/**
+ * Mode in which the standard output and error of background jobs are
+ * captured by the shell and written to the terminal one whole line at a time.
+ */
+#define JOB_OUTPUT_LINE 1
+
+/**
+ * Mode in which the standard output and error of background jobs are
+ * captured by the shell and written to the terminal once the job completes.
+ */
+#define JOB_OUTPUT_END 2
+
+/**
+ * Number of bytes of the captured output of a job that are kept. Older output
+ * is discarded, so the memory used per job is bounded.
+ */
+#define JOB_OUTPUT_SIZE 16384
+
+/**
+ * File descriptor value meaning a job has no captured output, or its output
+ * has been fully read.
+ */
+#define NO_OUTPUT -1
+
+/**
+ * Argument to the `jobs` command to display the captured output of a job.
+ */
+#define JOB_OUTPUT "-o"
+
+/**
+ * Size of the buffer where the input of the shell is read.
+ */
+#define INPUT_BUFFER_SIZE 65536
+
+/**
+ * Argument to the `metrics` command to stop serving metrics.
+ */
+#define METRICS_OFF "off"
+
+/**
+ * File descriptor value meaning metrics are not being served.
+ */
+#define NO_LISTENER -1
+
+/**
+ * Number of buckets of the latency histograms, the last one being unbounded.
+ */
+#define LATENCY_BUCKETS 12
+
+/**
+ * Upper bound in nanoseconds of the first bucket of the latency histograms.
+ * The bound of each following bucket doubles the previous one.
+ */
+#define LATENCY_BASE 10000
+
+/**
+ * Number of different exit statuses counted.
+ */
+#define EXIT_STATUSES 256
+
+/**
+ * Size of the buffer where the metrics report is written.
+ */
+#define METRICS_REPORT_SIZE 16384
+
+/**
+ * Key that completes the word being typed.
+ */
+#define KEY_TAB '\t'
+
+/**
+ * Key that removes the last character typed.
+ */
+#define KEY_ERASE 0x7f
+
+/**
+ * Alternative key that removes the last character typed (`Ctrl+H`).
+ */
+#define KEY_BACKSPACE '\b'
+
+/**
+ * Key that removes the whole line being typed (`Ctrl+U`).
+ */
+#define KEY_KILL 0x15
+
+/**
+ * Key that ends the input when the line is empty (`Ctrl+D`).
+ */
+#define KEY_END_OF_FILE 0x04
+
+/**
+ * Key that starts an escape sequence, such as the ones of the arrow keys.
+ */
+#define KEY_ESCAPE 0x1b
+
+/**
+ * State of the line editor when it is not reading an escape sequence.
+ */
+#define NO_ESCAPE 0
+
+/**
+ * State of the line editor after reading `KEY_ESCAPE`.
+ */
+#define ESCAPE_STARTED 1
+
+/**
+ * State of the line editor inside a control sequence (`ESC [`), which ends
+ * with a character between `@` and `~`.
+ */
+#define ESCAPE_CONTROL_SEQUENCE 2
+
+/**
+ * State of the line editor after a single shift (`ESC O`), which is followed
+ * by a single character, like the arrow keys of terminals in application
+ * mode.
+ */
+#define ESCAPE_SINGLE_SHIFT 3
+
+/**
+ * Value meaning that the line editor has not finished reading a line.
+ */
+#define NO_RESULT -1
+
+/**
+ * Characters that separate the words completed from what precedes them. A
+ * word following one of `|;&(` is the first word of a command.
+ */
+#define WORD_DELIMITERS "|;&(<>"
+
+/**
+ * Maximum number of candidates of a completion.
+ */
+#define MAXIMUM_COMPLETIONS 4096
+
+/**
+ * Number of directories kept in the completion index.
+ */
+#define COMPLETION_INDEX_CAPACITY 128
+
+/**
+ * Initial number of entries of the index of a directory.
+ */
+#define DIRECTORY_INDEX_CAPACITY 64
+
+/**
+ * Type of the directory entries that are not executables nor directories.
+ */
+#define ENTRY_FILE 0
+
+/**
+ * Type of the directory entries that are executable regular files.
+ */
+#define ENTRY_EXECUTABLE 1
+
+/**
+ * Type of the directory entries that are directories.
+ */
+#define ENTRY_DIRECTORY 2
+
+/**
+ * Value matching any type of directory entry.
+ */
+#define ENTRY_ANY -1
+
+/**
+ * Job index meaning that no job was found.
+ */
+#define NO_JOB -1
+
+/**
+ * Exit status of `wait` when the job to be waited for does not exist.
+ */
+#define UNKNOWN_JOB_STATUS 127
+
+/**
+ * Argument to the `wait` command to wait for the next job to finish.
+ */
+#define NEXT_JOB "-n"
+
+/**
+ * Character that may precede a job number, as in `wait %2`.
+ */
+#define JOB_PREFIX '%'
 
 /**
  * Signal number used for the kill system call to forcefully terminate a
@@ -133,650 +513,5229 @@
  *   - instruction: The instruction associated with the job.
  *   - size: The number of processes in the job.
  *   - pids: Array of process identifiers within the job.
+ *   - reaped: Array of flags indicating whether each process has been waited
+ *     for.
+ *   - remaining: The number of processes not waited for yet.
+ *   - status: The exit status of the last process of the job.
  *   - finished: Flag indicating whether the job has finished.
+ *   - mode: How the output of the job is written (`JOB_OUTPUT_OFF`,
+ *     `JOB_OUTPUT_LINE` or `JOB_OUTPUT_END`).
+ *   - output: The read end of the pipe capturing the output of the job, or
+ *     `NO_OUTPUT`.
+ *   - tail: Ring buffer of `JOB_OUTPUT_SIZE` bytes with the last captured
+ *     output.
+ *   - start: The index of the oldest byte of `tail`.
+ *   - length: The number of bytes of `tail`.
+ *   - line: The captured line not written yet, in `JOB_OUTPUT_LINE` mode.
+ *   - lineLength: The number of bytes of `line`.
  */
 typedef struct
 {
     char instruction[MAXIMUM_LINE_LENGTH];
     int size;
     pid_t pids[MAXIMUM_PID_LIST_SIZE];
+    int reaped[MAXIMUM_PID_LIST_SIZE];
+    int remaining;
+    int status;
     int finished;
+    int mode;
+    int output;
+    char *tail;
+    int start;
+    int length;
+    char *line;
+    int lineLength;
 } tjob;
 
+/**
+ * Structure representing the counters of the processes launched by the shell.
+ *
+ * It lives in memory shared with the child processes, so they can record how
+ * long they took to reach `exec`. Counters are only updated with atomic
+ * additions.
+ *
+ * Fields:
+ *   - spawn: Histogram of the time taken by `fork` in the shell.
+ *   - spawnSum: The total time taken by `fork`, in nanoseconds.
+ *   - exec: Histogram of the time from `fork` to `exec` in the children.
+ *   - execSum: The total time from `fork` to `exec`, in nanoseconds.
+ *   - exits: The number of processes waited for by exit status.
+ */
+typedef struct
+{
+    unsigned long spawn[LATENCY_BUCKETS];
+    unsigned long spawnSum;
+    unsigned long exec[LATENCY_BUCKETS];
+    unsigned long execSum;
+    unsigned long exits[EXIT_STATUSES];
+} tmetrics;
+
 /**
  * Structure representing the list of active jobs in the shell.
  *
  * Fields:
  *   - list: Pointer to the array of `tjob` structures.
  *   - size: The current size of the list (number of active jobs).
+ *   - metrics: The counters of the launched processes, or NULL if metrics
+ *     have never been enabled.
+ *   - listener: The socket where metrics are served, or `NO_LISTENER`.
+ *   - children: A `signalfd` that becomes readable when a child process
+ *     terminates, so processes can be waited for with `poll`.
+ *   - endpoint: The path of the socket where metrics are served.
  */
 typedef struct
 {
     tjob *list;
     int size;
+    tmetrics *metrics;
+    int listener;
+    int children;
+    char endpoint[sizeof(((struct sockaddr_un *) NULL)->sun_path)];
 } tjobs;
 
-void store(int *stdinfd, int *stdoutfd, int *stderrfd);
-void redirect(const tline *line);
-void auxiliarRedirect(char *filename, const char *MODE, const int STD_FILENO);
-void run(const tline *line, const int number);
-void restore(const int stdinfd, const int stdoutfd, const int stderrfd);
-void executeExternalCommands(const tline *line, tjobs *jobs, const char buffer[]);
-void mshcd(const char *directory);
-void mshumask(const char *mask, int *formattedMask);
-void printMask(const int mask);
-int octal(const char *number);
-void mshexit(tjobs *jobs);
-void mshjobs(tjobs *jobs);
-int finished(tjob *job);
-void mshfg(const char *job, tjobs *jobs);
-void delete(const int job, tjobs *jobs);
-void ctrlc();
-void ctrlc2();
+/**
+ * Structure representing a shell variable.
+ *
+ * Fields:
+ *   - name: The name of the variable, or NULL if the slot is empty.
+ *   - value: The value of the variable, or NULL if it was exported without
+ *     ever being assigned.
+ *   - exported: Flag indicating whether the variable is passed to the
+ *     environment of executed commands.
+ */
+typedef struct
+{
+    char *name;
+    char *value;
+    int exported;
+} tvariable;
 
-int main(void)
+/**
+ * Structure representing the variable store of the shell, an open addressing
+ * hash table with linear probing.
+ *
+ * Fields:
+ *   - list: Pointer to the array of `tvariable` slots.
+ *   - capacity: The number of slots, always a power of two.
+ *   - size: The number of variables stored.
+ *   - environment: The `envp` array built from the exported variables.
+ *   - outdated: Flag indicating whether an exported variable changed since
+ *     `environment` was built.
+ */
+typedef struct
 {
-    char buffer[MAXIMUM_LINE_LENGTH];
-    tline *line;
-    char **firstCommandArguments;
-    int formattedMask;
-    tjobs jobs;
+    tvariable *list;
+    int capacity;
+    int size;
+    char **environment;
+    int outdated;
+} tvariables;
 
-    formattedMask = DEFAULT_UNIX_FORMATTED_MASK;
-    umask(DEFAULT_UNIX_MASK);
+/**
+ * Structure representing the execution plan of a command line, cached so
+ * repeated command lines are neither parsed nor planned again.
+ *
+ * Fields:
+ *   - key: The expanded command line, or NULL if the slot is empty.
+ *   - line: Copy of the parsed command line, whose commands hold the resolved
+ *     path of their executable.
+ *   - internal: Flag indicating whether the command line may run an internal
+ *     command instead of external ones.
+ *   - patterns: Flag indicating whether some argument is a filename pattern.
+ *   - expansions: Flag indicating whether some word has variables to be
+ *     expanded after parsing.
+ *   - dynamic: Flag indicating whether the name of some command has variables,
+ *     in which case the whole command line is expanded before parsing.
+ *   - used: Flag indicating whether the plan was found in the cache since the
+ *     previous eviction.
+ */
+typedef struct
+{
+    char *key;
+    tline line;
+    int internal;
+    int patterns;
+    int expansions;
+    int dynamic;
+    int used;
+} tplan;
 
-    jobs.list = malloc(sizeof(tjob) * MAXIMUM_JOB_LIST_SIZE);
-    jobs.size = 0;
+/**
+ * Structure representing the cache of execution plans, an open addressing hash
+ * table with linear probing.
+ *
+ * Fields:
+ *   - list: Pointer to the array of `tplan` slots.
+ *   - capacity: The number of slots, always a power of two.
+ *   - size: The number of plans stored.
+ *   - path: The `PATH` the commands of the plans were resolved with.
+ */
+typedef struct
+{
+    tplan *list;
+    int capacity;
+    int size;
+    char *path;
+} tplans;
+
+/**
+ * Structure representing the input of the shell, read in large blocks and
+ * split into lines.
+ *
+ * Fields:
+ *   - data: The bytes read and not consumed yet.
+ *   - start: The index of the first byte not consumed.
+ *   - end: The index following the last byte read.
+ *   - closed: Flag indicating whether the end of the input has been reached.
+ */
+typedef struct
+{
+    char data[INPUT_BUFFER_SIZE];
+    int start;
+    int end;
+    int closed;
+} tinput;
+
+/**
+ * Structure representing an entry of an indexed directory.
+ *
+ * Fields:
+ *   - name: The name of the entry.
+ *   - type: The type of the entry (`ENTRY_FILE`, `ENTRY_EXECUTABLE` or
+ *     `ENTRY_DIRECTORY`).
+ */
+typedef struct
+{
+    char *name;
+    int type;
+} tentry;
+
+/**
+ * Structure representing the index of the entries of a directory, used to
+ * complete names.
+ *
+ * Fields:
+ *   - path: The path of the directory.
+ *   - modified: The modification time of the directory when it was indexed.
+ *   - entries: Array of the entries of the directory, sorted by name.
+ *   - size: The number of entries.
+ *   - names: Block of memory holding the names of the entries.
+ */
+typedef struct
+{
+    char *path;
+    struct timespec modified;
+    tentry *entries;
+    int size;
+    char *names;
+} tdirectory;
+
+/**
+ * Structure representing the index of the directories used to complete
+ * names, built lazily as directories are completed.
+ *
+ * Fields:
+ *   - list: Array of `COMPLETION_INDEX_CAPACITY` indexed directories.
+ *   - size: The number of indexed directories.
+ *   - next: The index of the directory replaced when the list is full.
+ */
+typedef struct
+{
+    tdirectory list[COMPLETION_INDEX_CAPACITY];
+    int size;
+    int next;
+} tindex;
+
+/**
+ * Structure representing the state of the shell.
+ *
+ * Fields:
+ *   - jobs: The list of active jobs.
+ *   - variables: The shell and environment variables.
+ *   - plans: The cache of execution plans.
+ *   - formattedMask: The Unix mask value for display purposes.
+ *   - pipeSize: The capacity requested for pipeline pipes.
+ *   - jobOutput: How the output of new background jobs is written.
+ *   - substitution: The exit status of the last command substitution of the
+ *     command line being evaluated, or `EXIT_SUCCESS` if it has none.
+ *   - input: The input of the shell.
+ *   - index: The index of the directories used to complete names.
+ */
+typedef struct
+{
+    tjobs jobs;
+    tvariables variables;
+    tplans plans;
+    int formattedMask;
+    int pipeSize;
+    int jobOutput;
+    int substitution;
+    tinput input;
+    tindex index;
+} tshell;
+
+/**
+ * Structure representing a symbol of a compiled filename pattern.
+ *
+ * Fields:
+ *   - type: The type of symbol (`LITERAL_SYMBOL`, `ANY_SYMBOL`, `STAR_SYMBOL`
+ *     or `CLASS_SYMBOL`).
+ *   - character: The character matched by a literal symbol.
+ *   - set: Bitmap of the characters matched by a class symbol.
+ */
+typedef struct
+{
+    int type;
+    unsigned char character;
+    unsigned char set[32];
+} tsymbol;
+
+/**
+ * Structure representing a filename pattern compiled into a matcher.
+ *
+ * Only the last component of a path may contain wildcards.
+ *
+ * Fields:
+ *   - directory: The directory part of the pattern, with its trailing slash,
+ *     or an empty string for the current directory.
+ *   - symbols: Array of symbols of the last component.
+ *   - size: The number of symbols.
+ *   - prefix: Number of literal symbols the pattern starts with.
+ *   - suffix: The literal characters the pattern ends with after its last
+ *     `*`, checked before running the matcher.
+ *   - hidden: Flag indicating whether names starting with a dot can match.
+ *   - directories: Flag indicating whether only directories can match, when
+ *     the pattern ends with a slash.
+ */
+typedef struct
+{
+    char *directory;
+    tsymbol *symbols;
+    int size;
+    int prefix;
+    char *suffix;
+    int hidden;
+    int directories;
+} tpattern;
+
+/**
+ * Structure representing a node of a parsed command, which is parsed once and
+ * then executed as many times as needed.
+ *
+ * Fields:
+ *   - type: The type of node (`COMMAND_NODE`, `FOR_NODE`, `WHILE_NODE` or
+ *     `IF_NODE`).
+ *   - text: The command line, the condition, or the words of a `for` loop.
+ *   - name: The variable of a `for` loop.
+ *   - documents: NULL terminated array of the bodies of the here-documents of
+ *     `text`, in order and not expanded, or NULL if it has none.
+ *   - body: The first node of the loop body or of the `then` branch.
+ *   - alternative: The first node of the `else` branch.
+ *   - next: The following node of the same list.
+ */
+typedef struct tnode
+{
+    int type;
+    char *text;
+    char *name;
+    char **documents;
+    struct tnode *body;
+    struct tnode *alternative;
+    struct tnode *next;
+} tnode;
+
+/**
+ * Structure representing the source command lines are read from, split into
+ * the segments separated by `SEPARATOR`.
+ *
+ * Fields:
+ *   - line: The last line read.
+ *   - position: The start of the next segment in `line`, or NULL if the line
+ *     has been consumed.
+ *   - pending: Segment to be returned before the ones of `line`, such as the
+ *     command following a `do` keyword, or an empty string.
+ *   - shell: The shell whose input the lines are read from.
+ */
+typedef struct
+{
+    char line[MAXIMUM_LINE_LENGTH];
+    char *position;
+    char pending[MAXIMUM_LINE_LENGTH];
+    tshell *shell;
+} tsource;
+
+int readLine(char buffer[], const int size, const char *prompt, tshell *shell);
+int await(tshell *shell);
+int exhausted(const tinput *input);
+int edit(char buffer[], const int size, const char *prompt, tshell *shell);
+void complete(char buffer[], int *length, const int size, const char *prompt, tshell *shell);
+int candidates(const tdirectory *directory, const char *prefix, const int prefixLength, const int type, char *matches[], int types[], int count);
+tdirectory *indexDirectory(const char *path, const int commands, tshell *shell);
+void buildDirectory(tdirectory *directory);
+int compareEntries(const void *first, const void *second);
+int outputs(tjobs *jobs, struct pollfd fds[], int owners[]);
+void interpret(tsource *source, tshell *shell);
+int next(tsource *source, char segment[], const int more);
+int keyword(const char *segment, const char *word, char **rest);
+int statement(tsource *source, char segment[], tnode **node);
+int loop(tsource *source, char segment[], tnode *node);
+int conditional(tsource *source, char segment[], tnode *node);
+int block(tsource *source, const char *closing[], char segment[], tnode **list);
+int closed(const char *segment, const char *word);
+int execute(const tnode *node, tshell *shell);
+void remember(const int status, tshell *shell);
+void destroy(tnode *node);
+int evaluate(const char buffer[], char *documents[], tshell *shell);
+int heredoc(char line[], char *documents[], int *input, tshell *shell);
+char *nextHeredoc(const char *text, char **start, char **end);
+void gather(tsource *source, const char *text, char ***documents);
+int expandArguments(const tline *source, tline *destination, tshell *shell);
+void split(char *value, char ***arguments, int *size, int *capacity);
+int wildcards(const tline *line);
+int feed(const char *body, const int length, const int pipeSize);
+int transfer(const int fd, const char *data, const int length);
+tplan *plan(const char *key, tshell *shell);
+int internal(const char *command);
+const char **builtins(void);
+void copy(tline *destination, const tline *source);
+void expandPatterns(const tline *source, tline *destination);
+void expandPattern(const char *word, char ***matches, int *size, int *capacity);
+void releasePatterns(tline *expanded, const tline *source);
+int compilePattern(const char *argument, tpattern *pattern);
+int matchPattern(const tpattern *pattern, const char *name);
+int scanDirectory(const tpattern *pattern, char ***matches, int *size, int *capacity);
+int compareNames(const void *first, const void *second);
+void release(tline *line);
+void flush(tplans *plans);
+int probe(const tplans *plans, const char *key);
+void rehash(tplans *plans, const int capacity, const int evict);
+char *expand(const char buffer[], tshell *shell);
+void reserve(char **buffer, int *capacity, const int needed);
+int variable(const char character, const int first);
+int substitute(const char *command, char **output, int *length, int *capacity, tshell *shell);
+void store(int *stdinfd, int *stdoutfd, int *stderrfd);
+void redirect(const tline *line, const int input, const int output);
+void auxiliarRedirect(char *filename, const char *MODE, const int STD_FILENO);
+void run(const tline *line, const int number, char *const environment[]);
+void restore(const int stdinfd, const int stdoutfd, const int stderrfd);
+int executeExternalCommands(const tline *line, tshell *shell, const char buffer[], const int input);
+int exitStatus(const int status);
+int createPipe(int p[PIPE], const int size);
+void mshcd(const char *directory, tvariables *variables);
+void mshumask(const char *mask, int *formattedMask);
+void printMask(const int mask);
+int octal(const char *number);
+void mshpipesize(const char *size, int *pipeSize);
+int maximumPipeSize();
+void mshexport(char *arguments[], tvariables *variables);
+void mshunset(char *arguments[], tvariables *variables);
+void mshassign(char *arguments[], tvariables *variables);
+int assignment(const char *argument);
+int identifier(const char *name, const int length);
+void initialize(tvariables *variables);
+unsigned long hash(const char *string, const int length);
+int locate(const tvariables *variables, const char *name, const int length);
+char *lookup(const tvariables *variables, const char *name, const int length);
+void assign(tvariables *variables, const char *name, const int length, const char *value, const int exported);
+void declare(tvariables *variables, const char *name, const int length);
+void discard(tvariables *variables, const char *name);
+void grow(tvariables *variables);
+char **environment(tvariables *variables);
+void mshexit(tjobs *jobs);
+void mshjobs(char *arguments[], tjobs *jobs);
+void mshjobbuffer(const char *mode, int *jobOutput);
+void capture(tjob *job, const char *data, const int size);
+void drain(tjob *job);
+void flushOutput(tjob *job);
+void printTail(const tjob *job);
+pid_t collect(tjobs *jobs, const pid_t pid, int *status);
+void abandon(tjobs *jobs);
+void mshmetrics(const char *path, tjobs *jobs);
+void serve(tjobs *jobs);
+int report(tjobs *jobs, char buffer[], const int size);
+int histogram(char buffer[], const int size, const char *name, const unsigned long buckets[], const unsigned long *sum);
+long timestamp(void);
+void observe(unsigned long buckets[], unsigned long *sum, const long start);
+void tally(tmetrics *metrics, const int status);
+int finished(tjob *job, tmetrics *metrics);
+void mark(tjob *job, const int index, const int status);
+int record(tjobs *jobs, const pid_t pid, const int status);
+int reap(tjobs *jobs);
+int mshwait(char *arguments[], tjobs *jobs);
+void mshfg(const char *job, tjobs *jobs);
+void delete(const int job, tjobs *jobs);
+void ctrlc();
+void ctrlc2();
+
+int main(void)
+{
+    tsource source;
+    tshell shell;
+    sigset_t children;
+
+    shell.formattedMask = DEFAULT_UNIX_FORMATTED_MASK;
+    shell.pipeSize = DEFAULT_PIPE_SIZE;
+    shell.jobOutput = JOB_OUTPUT_OFF;
+    shell.substitution = EXIT_SUCCESS;
+
+    shell.input.start = 0;
+    shell.input.end = 0;
+    shell.input.closed = 0;
+
+    shell.index.size = 0;
+    shell.index.next = 0;
+    umask(DEFAULT_UNIX_MASK);
+
+    shell.jobs.list = malloc(sizeof(tjob) * MAXIMUM_JOB_LIST_SIZE);
+    shell.jobs.size = 0;
+    shell.jobs.metrics = NULL;
+    shell.jobs.listener = NO_LISTENER;
+
+    // Terminated children are reported through a file descriptor instead
+    sigemptyset(&children);
+    sigaddset(&children, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &children, NULL);
+    shell.jobs.children = signalfd(-1, &children, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    initialize(&shell.variables);
+
+    shell.plans.capacity = PLAN_CACHE_CAPACITY;
+    shell.plans.list = calloc(shell.plans.capacity, sizeof(tplan));
+    shell.plans.size = 0;
+    shell.plans.path = NULL;
+
+    remember(EXIT_SUCCESS, &shell);
+
+    source.pending[0] = '\0';
+    source.shell = &shell;
 
     signal(SIGINT, ctrlc);
 
     printf(PROMPT);
-    while (fgets(buffer, MAXIMUM_LINE_LENGTH, stdin))
+    while (readLine(source.line, MAXIMUM_LINE_LENGTH, PROMPT, &shell))
+    {
+        source.position = source.line;
+        interpret(&source, &shell);
+
+        printf(PROMPT);
+    }
+
+    mshmetrics(METRICS_OFF, &shell.jobs);
+
+    return 0;
+}
+
+/**
+ * Read a line of the input of the shell, like `fgets` does.
+ *
+ * This is the event loop of the shell: while it waits for the input, it also
+ * drains the captured output of background jobs, so they never block on a full
+ * pipe while the user is typing, and serves metrics requests. When the input
+ * is a terminal, the line is read with the line editor of the shell.
+ *
+ * @param buffer Buffer where the line is stored, with its newline character.
+ * @param size The capacity of the buffer.
+ * @param prompt The prompt displayed before the line.
+ * @param shell A pointer to the structure representing the shell state.
+ * @return 1 if a line was stored, 0 if the end of the input was reached.
+ */
+int readLine(char buffer[], const int size, const char *prompt, tshell *shell)
+{
+    tinput *input;
+    char *newline;
+    int length, bytes;
+
+    input = &shell->input;
+
+    if (isatty(STDIN_FILENO))
     {
-        line = tokenize(buffer);
+        return edit(buffer, size, prompt, shell);
+    }
+
+    while (1)
+    {
+        newline = memchr(&input->data[input->start], '\n', input->end - input->start);
+        length = newline == NULL ? input->end - input->start : newline - &input->data[input->start] + 1;
 
-        if (line == NULL || line->ncommands < 1)
+        if (newline != NULL || length >= size - 1 || (input->closed && length > 0))
         {
-            printf(PROMPT);
-            continue;
+            length = length < size - 1 ? length : size - 1;
+
+            memcpy(buffer, &input->data[input->start], length);
+            buffer[length] = '\0';
+            input->start += length;
+
+            return 1;
+        }
+
+        if (input->closed)
+        {
+            return 0;
         }
 
-        firstCommandArguments = line->commands[0].argv;
+        memmove(input->data, &input->data[input->start], length);
+        input->start = 0;
+        input->end = length;
 
-        if (strcmp(firstCommandArguments[COMMAND], "cd") == 0)
+        if (await(shell) == -1)
         {
-            mshcd(firstCommandArguments[DIRECTORY]);
+            continue;
         }
-        else if (strcmp(firstCommandArguments[COMMAND], "umask") == 0)
+
+        bytes = read(STDIN_FILENO, &input->data[input->end], INPUT_BUFFER_SIZE - input->end);
+
+        if (bytes > 0)
         {
-            mshumask(firstCommandArguments[MASK], &formattedMask);
+            input->end += bytes;
         }
-        else if (strcmp(firstCommandArguments[COMMAND], "exit") == 0)
+        else if (bytes == 0 || errno != EINTR)
         {
-            mshexit(&jobs);
+            input->closed = 1;
         }
-        else if (strcmp(firstCommandArguments[COMMAND], "jobs") == 0)
+    }
+}
+
+/**
+ * Wait until the input of the shell can be read, draining the captured output
+ * of background jobs and serving metrics requests meanwhile.
+ *
+ * @param shell A pointer to the structure representing the shell state.
+ * @return 0 if the input can be read, -1 if the wait was interrupted by a
+ * signal.
+ */
+int await(tshell *shell)
+{
+    struct pollfd fds[MAXIMUM_JOB_LIST_SIZE + 2];
+    int owners[MAXIMUM_JOB_LIST_SIZE];
+    int count, index, listening;
+
+    // The prompt must be visible before blocking
+    fflush(stdout);
+
+    while (1)
+    {
+        count = outputs(&shell->jobs, fds, owners);
+        fds[count].fd = STDIN_FILENO;
+        fds[count].events = POLLIN;
+        fds[count].revents = 0;
+
+        listening = shell->jobs.listener != NO_LISTENER;
+        fds[count + 1].fd = shell->jobs.listener;
+        fds[count + 1].events = POLLIN;
+        fds[count + 1].revents = 0;
+
+        if (poll(fds, count + 1 + listening, -1) == -1)
         {
-            mshjobs(&jobs);
+            return -1;
         }
-        else if (strcmp(firstCommandArguments[COMMAND], "fg") == 0)
+
+        if (listening && fds[count + 1].revents != 0)
         {
-            mshfg(firstCommandArguments[JOB], &jobs);
+            serve(&shell->jobs);
         }
-        else
+
+        for (index = 0; index < count; index++)
         {
-            executeExternalCommands(line, &jobs, buffer);
+            if (fds[index].revents != 0)
+            {
+                drain(&shell->jobs.list[owners[index]]);
+            }
         }
 
-        printf(PROMPT);
+        if (fds[count].revents != 0)
+        {
+            return 0;
+        }
     }
+}
 
-    return 0;
+/**
+ * Check if the whole input of the shell has been read, so no prompt should be
+ * displayed for further lines.
+ *
+ * @param input A pointer to the input of the shell.
+ * @return 1 if the end of the input was reached and no bytes are left, 0
+ * otherwise.
+ */
+int exhausted(const tinput *input)
+{
+    return input->closed && input->start == input->end;
 }
 
 /**
- * Store the standard input, output, and error file descriptors for later
- * restoration.
+ * Read a line from the terminal, letting the user edit it.
  *
- * @param stdinfd Pointer to the variable to store the original standard input
- * file descriptor.
- * @param stdoutfd Pointer to the variable to store the original standard
- * output file descriptor.
- * @param stderrfd Pointer to the variable to store the original standard error
- * file descriptor.
+ * The terminal is switched to noncanonical mode without echo while the line is
+ * read. Characters are appended to the line, `KEY_ERASE` and `KEY_BACKSPACE`
+ * remove the last one, `KEY_KILL` removes the whole line, `KEY_END_OF_FILE`
+ * on an empty line ends the input, and `KEY_TAB` completes the last word.
+ * Escape sequences, such as the ones the arrow keys send in either cursor mode
+ * (`ESC [ A` or `ESC O A`), are ignored. The terminal is read one byte at a
+ * time, so input typed ahead after the end of the line is left to whatever
+ * reads the terminal next, such as the command being run.
+ *
+ * @param buffer Buffer where the line is stored, with its newline character.
+ * @param size The capacity of the buffer.
+ * @param prompt The prompt displayed before the line.
+ * @param shell A pointer to the structure representing the shell state.
+ * @return 1 if a line was stored, 0 if the end of the input was reached.
  */
-void store(int *stdinfd, int *stdoutfd, int *stderrfd)
+int edit(char buffer[], const int size, const char *prompt, tshell *shell)
 {
-    dup2(STDERR_FILENO, *stderrfd);
-    dup2(STDIN_FILENO, *stdinfd);
-    dup2(STDOUT_FILENO, *stdoutfd);
+    struct termios original, raw;
+    tinput *input;
+    int length, bytes, result, escape;
+    unsigned char character;
+
+    input = &shell->input;
+    length = 0;
+    escape = NO_ESCAPE;
+    result = NO_RESULT;
+
+    tcgetattr(STDIN_FILENO, &original);
+    raw = original;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+    while (result == NO_RESULT)
+    {
+        if (input->start == input->end)
+        {
+            if (input->closed)
+            {
+                result = length > 0;
+                buffer[length++] = '\n';
+                break;
+            }
+
+            // Ctrl-C discards the line, the signal handler displays the prompt
+            if (await(shell) == -1)
+            {
+                length = 0;
+                continue;
+            }
+
+            // One byte at a time, so pasted lines meant for the next command
+            // stay in the terminal queue when this line ends
+            bytes = read(STDIN_FILENO, input->data, 1);
+
+            if (bytes > 0)
+            {
+                input->start = 0;
+                input->end = bytes;
+            }
+            else if (bytes == 0 || errno != EINTR)
+            {
+                input->closed = 1;
+            }
+            continue;
+        }
+
+        character = input->data[input->start++];
+
+        if (escape == ESCAPE_STARTED)
+        {
+            if (character == '[')
+            {
+                escape = ESCAPE_CONTROL_SEQUENCE;
+            }
+            else if (character == 'O')
+            {
+                escape = ESCAPE_SINGLE_SHIFT;
+            }
+            else if (character != KEY_ESCAPE)
+            {
+                escape = NO_ESCAPE;
+            }
+        }
+        else if (escape == ESCAPE_CONTROL_SEQUENCE)
+        {
+            escape = character >= '@' && character <= '~' ? NO_ESCAPE : ESCAPE_CONTROL_SEQUENCE;
+        }
+        else if (escape == ESCAPE_SINGLE_SHIFT)
+        {
+            escape = NO_ESCAPE;
+        }
+        else if (character == '\n' || character == '\r')
+        {
+            buffer[length++] = '\n';
+            putchar('\n');
+            result = 1;
+        }
+        else if (character == KEY_END_OF_FILE && length == 0)
+        {
+            putchar('\n');
+            result = 0;
+        }
+        else if ((character == KEY_ERASE || character == KEY_BACKSPACE) && length > 0)
+        {
+            length--;
+            printf("\b \b");
+        }
+        else if (character == KEY_KILL)
+        {
+            for (; length > 0; length--)
+            {
+                printf("\b \b");
+            }
+        }
+        else if (character == KEY_TAB)
+        {
+            complete(buffer, &length, size, prompt, shell);
+        }
+        else if (character == KEY_ESCAPE)
+        {
+            escape = ESCAPE_STARTED;
+        }
+        else if (character >= ' ' && length < size - 2)
+        {
+            buffer[length++] = character;
+            putchar(character);
+        }
+
+        if (input->start == input->end || result != NO_RESULT)
+        {
+            fflush(stdout);
+        }
+    }
+
+    buffer[length] = '\0';
+
+    tcsetattr(STDIN_FILENO, TCSANOW, &original);
+
+    return result;
 }
 
 /**
- * Redirect standard input, output, and error based on the information provided
- * in the given command line structure.
+ * Complete the last word of a line being edited.
  *
- * @param line A pointer to a `tline` structure representing the command line.
- * @param stdinfd Pointer to the variable to store the original standard input
- * file descriptor.
- * @param stdoutfd Pointer to the variable to store the original standard
- * output file descriptor.
- * @param stderrfd Pointer to the variable to store the original standard error
- * file descriptor.
+ * The first word of a command is completed with the internal commands and the
+ * executables of the directories of `PATH`, any other word with the names of
+ * files. If there is a single candidate, it is completed and followed by a
+ * space, or by a slash if it is a directory. If there are several, their
+ * common prefix is completed or, if there is nothing to complete, they are
+ * displayed.
+ *
+ * @param buffer The line being edited.
+ * @param length Pointer to the length of the line.
+ * @param size The capacity of the line.
+ * @param prompt The prompt displayed before the line.
+ * @param shell A pointer to the structure representing the shell state.
+ */
+void complete(char buffer[], int *length, const int size, const char *prompt, tshell *shell)
+{
+    static char *matches[MAXIMUM_COMPLETIONS];
+    static int types[MAXIMUM_COMPLETIONS];
+    char directory[PATH_MAX];
+    const char **commands;
+    char *word, *slash, *path, *end;
+    int start, before, command, count, index, common, prefixLength, directoryLength;
+    tdirectory *indexed;
+
+    start = *length;
+    while (start > 0 && !isspace((unsigned char)buffer[start - 1]) && strchr(WORD_DELIMITERS, buffer[start - 1]) == NULL)
+    {
+        start--;
+    }
+
+    before = start;
+    while (before > 0 && isspace((unsigned char)buffer[before - 1]))
+    {
+        before--;
+    }
+
+    buffer[*length] = '\0';
+    word = &buffer[start];
+    slash = strrchr(word, '/');
+    command = slash == NULL && (before == 0 || strchr(WORD_DELIMITERS, buffer[before - 1]) != NULL);
+    count = 0;
+
+    if (command)
+    {
+        prefixLength = strlen(word);
+        commands = builtins();
+
+        for (index = 0; commands[index] != NULL; index++)
+        {
+            if (strncmp(commands[index], word, prefixLength) == 0)
+            {
+                matches[count] = (char *)commands[index];
+                types[count++] = ENTRY_EXECUTABLE;
+            }
+        }
+
+        path = lookup(&shell->variables, PATH, strlen(PATH));
+
+        while (path != NULL && *path != '\0')
+        {
+            end = strchr(path, ':');
+            directoryLength = end == NULL ? (int)strlen(path) : end - path;
+
+            // Empty entries stand for the working directory
+            snprintf(directory, PATH_MAX, "%.*s", directoryLength, directoryLength == 0 ? "." : path);
+
+            indexed = indexDirectory(directory, 1, shell);
+            count = candidates(indexed, word, prefixLength, ENTRY_EXECUTABLE, matches, types, count);
+
+            path = end == NULL ? NULL : end + 1;
+        }
+    }
+    else
+    {
+        if (slash == NULL)
+        {
+            strcpy(directory, ".");
+        }
+        else
+        {
+            snprintf(directory, PATH_MAX, "%.*s", (int)(slash - word) + 1, word);
+            word = slash + 1;
+        }
+
+        prefixLength = strlen(word);
+
+        indexed = indexDirectory(directory, 0, shell);
+        count = candidates(indexed, word, prefixLength, ENTRY_ANY, matches, types, 0);
+    }
+
+    if (count == 0)
+    {
+        putchar('\a');
+        return;
+    }
+
+    // Length of the prefix shared by every candidate
+    common = strlen(matches[0]);
+    for (index = 1; index < count; index++)
+    {
+        for (start = prefixLength; start < common && matches[index][start] == matches[0][start]; start++);
+        common = start;
+    }
+
+    for (index = prefixLength; index < common && *length < size - 2; index++)
+    {
+        buffer[(*length)++] = matches[0][index];
+        putchar(matches[0][index]);
+    }
+
+    for (index = 1; index < count && strcmp(matches[index], matches[0]) == 0; index++);
+
+    if (index == count && *length < size - 2)
+    {
+        buffer[*length] = types[0] == ENTRY_DIRECTORY ? '/' : ' ';
+        putchar(buffer[(*length)++]);
+    }
+    else if (index < count && common == prefixLength)
+    {
+        qsort(matches, count, sizeof(char *), compareNames);
+
+        putchar('\n');
+        for (index = 0; index < count; index++)
+        {
+            if (index == 0 || strcmp(matches[index], matches[index - 1]) != 0)
+            {
+                printf("%s  ", matches[index]);
+            }
+        }
+
+        buffer[*length] = '\0';
+        printf("\n%s%s", prompt, buffer);
+    }
+}
+
+/**
+ * Append to a list of candidates the entries of an indexed directory starting
+ * with a prefix.
+ *
+ * The entries are sorted, so the first candidate is found with a binary
+ * search. Hidden entries are skipped unless the prefix starts with a dot.
+ *
+ * @param directory The indexed directory, or NULL if it could not be read.
+ * @param prefix The prefix.
+ * @param prefixLength The length of the prefix.
+ * @param type The type of the entries to append, or `ENTRY_ANY`.
+ * @param matches Array where the names of the candidates are appended.
+ * @param types Array where the types of the candidates are appended.
+ * @param count The number of candidates in the list.
+ * @return The number of candidates in the list after appending.
+ */
+int candidates(const tdirectory *directory, const char *prefix, const int prefixLength, const int type, char *matches[], int types[], int count)
+{
+    int low, high, middle;
+    tentry *entry;
+
+    if (directory == NULL)
+    {
+        return count;
+    }
+
+    low = 0;
+    high = directory->size;
+
+    while (low < high)
+    {
+        middle = (low + high) / 2;
+
+        if (strncmp(directory->entries[middle].name, prefix, prefixLength) < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    for (; low < directory->size && count < MAXIMUM_COMPLETIONS; low++)
+    {
+        entry = &directory->entries[low];
+
+        if (strncmp(entry->name, prefix, prefixLength) != 0)
+        {
+            break;
+        }
+
+        if ((type == ENTRY_ANY || entry->type == type) && (entry->name[0] != '.' || prefix[0] == '.'))
+        {
+            matches[count] = entry->name;
+            types[count++] = entry->type;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Get the index of a directory, building it on first use and rebuilding it
+ * when the modification time of the directory changes.
+ *
+ * The modification time of a directory changes whenever entries are added to
+ * it or removed from it. When a directory of `PATH` changes, the execution
+ * plan cache is flushed as well, since the plans hold the paths commands were
+ * resolved to.
+ *
+ * @param path The path of the directory.
+ * @param commands Flag indicating whether the directory is part of `PATH`.
+ * @param shell A pointer to the structure representing the shell state.
+ * @return The index of the directory, or NULL if it could not be read.
+ */
+tdirectory *indexDirectory(const char *path, const int commands, tshell *shell)
+{
+    tindex *cache;
+    tdirectory *directory;
+    struct stat information;
+    int position;
+
+    cache = &shell->index;
+
+    if (stat(path, &information) == -1 || !S_ISDIR(information.st_mode))
+    {
+        return NULL;
+    }
+
+    for (position = 0; position < cache->size && strcmp(cache->list[position].path, path) != 0; position++);
+
+    if (position < cache->size)
+    {
+        directory = &cache->list[position];
+
+        if (directory->modified.tv_sec == information.st_mtim.tv_sec && directory->modified.tv_nsec == information.st_mtim.tv_nsec)
+        {
+            return directory;
+        }
+
+        if (commands)
+        {
+            flush(&shell->plans);
+        }
+
+        free(directory->entries);
+        free(directory->names);
+    }
+    else if (cache->size < COMPLETION_INDEX_CAPACITY)
+    {
+        directory = &cache->list[cache->size++];
+        directory->path = strdup(path);
+    }
+    else
+    {
+        // Once the index is full, directories are replaced in turn
+        directory = &cache->list[cache->next];
+        cache->next = (cache->next + 1) % COMPLETION_INDEX_CAPACITY;
+
+        free(directory->path);
+        free(directory->entries);
+        free(directory->names);
+
+        directory->path = strdup(path);
+    }
+
+    directory->modified = information.st_mtim;
+    buildDirectory(directory);
+
+    return directory;
+}
+
+/**
+ * Read the entries of a directory into its index, sorted by name.
+ *
+ * The type of each entry is taken from `d_type` when possible; files,
+ * symbolic links and entries of file systems that do not report the type are
+ * `stat`ed to tell executables and directories apart.
+ *
+ * @param directory The index of the directory, whose path is set.
+ */
+void buildDirectory(tdirectory *directory)
+{
+    DIR *stream;
+    struct dirent *dirent;
+    struct stat information;
+    int capacity, poolSize, poolCapacity, nameLength, index, offset;
+    int *offsets;
+
+    directory->entries = NULL;
+    directory->names = NULL;
+    directory->size = 0;
+
+    stream = opendir(directory->path);
+
+    if (stream == NULL)
+    {
+        return;
+    }
+
+    capacity = 0;
+    poolSize = 0;
+    poolCapacity = 0;
+    offsets = NULL;
+
+    while ((dirent = readdir(stream)) != NULL)
+    {
+        if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        if (directory->size == capacity)
+        {
+            capacity = capacity == 0 ? DIRECTORY_INDEX_CAPACITY : capacity * 2;
+            directory->entries = realloc(directory->entries, capacity * sizeof(tentry));
+            offsets = realloc(offsets, capacity * sizeof(int));
+        }
+
+        nameLength = strlen(dirent->d_name) + 1;
+
+        if (poolSize + nameLength > poolCapacity)
+        {
+            poolCapacity = poolCapacity == 0 ? DIRECTORY_INDEX_CAPACITY * NAME_MAX : poolCapacity * 2;
+            directory->names = realloc(directory->names, poolCapacity);
+        }
+
+        memcpy(&directory->names[poolSize], dirent->d_name, nameLength);
+        offsets[directory->size] = poolSize;
+        poolSize += nameLength;
+
+        if (dirent->d_type == DT_DIR)
+        {
+            directory->entries[directory->size].type = ENTRY_DIRECTORY;
+        }
+        else if (dirent->d_type != DT_REG && dirent->d_type != DT_LNK && dirent->d_type != DT_UNKNOWN)
+        {
+            directory->entries[directory->size].type = ENTRY_FILE;
+        }
+        else if (fstatat(dirfd(stream), dirent->d_name, &information, 0) == -1)
+        {
+            directory->entries[directory->size].type = ENTRY_FILE;
+        }
+        else if (S_ISDIR(information.st_mode))
+        {
+            directory->entries[directory->size].type = ENTRY_DIRECTORY;
+        }
+        else
+        {
+            directory->entries[directory->size].type = S_ISREG(information.st_mode) && (information.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)) ? ENTRY_EXECUTABLE : ENTRY_FILE;
+        }
+
+        directory->size++;
+    }
+
+    closedir(stream);
+
+    // The pool may have moved while growing, so names are pointed to at the end
+    for (index = 0; index < directory->size; index++)
+    {
+        offset = offsets[index];
+        directory->entries[index].name = &directory->names[offset];
+    }
+
+    free(offsets);
+
+    qsort(directory->entries, directory->size, sizeof(tentry), compareEntries);
+}
+
+/**
+ * Compare two entries of an indexed directory by name.
+ *
+ * @param first Pointer to the first entry.
+ * @param second Pointer to the second entry.
+ * @return An integer less than, equal to, or greater than zero if the name of
+ * the first entry sorts before, equal to, or after the name of the second.
+ */
+int compareEntries(const void *first, const void *second)
+{
+    return strcmp(((const tentry *)first)->name, ((const tentry *)second)->name);
+}
+
+/**
+ * Fill an array of `poll` entries with the pipes capturing the output of the
+ * background jobs.
+ *
+ * @param jobs A pointer to the structure representing the list of active jobs.
+ * @param fds Array where the `poll` entries are stored.
+ * @param owners Array where the index of the job of each entry is stored.
+ * @return The number of entries stored.
+ */
+int outputs(tjobs *jobs, struct pollfd fds[], int owners[])
+{
+    int j, count;
+
+    count = 0;
+
+    for (j = 0; j < jobs->size; j++)
+    {
+        if (jobs->list[j].output != NO_OUTPUT)
+        {
+            fds[count].fd = jobs->list[j].output;
+            fds[count].events = POLLIN;
+            fds[count].revents = 0;
+            owners[count++] = j;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Parse and execute the commands of the last line read from a source.
+ *
+ * Compound commands (`for`, `while` and `if`) may span several lines, which
+ * are read from the source until the compound command is complete. Each
+ * command is parsed once into a tree of nodes and then executed.
+ *
+ * @param source A pointer to the source whose last line is interpreted.
+ * @param shell A pointer to the structure representing the shell state.
+ */
+void interpret(tsource *source, tshell *shell)
+{
+    char segment[MAXIMUM_LINE_LENGTH];
+    tnode *node;
+
+    while (next(source, segment, 0))
+    {
+        node = NULL;
+
+        if (statement(source, segment, &node))
+        {
+            execute(node, shell);
+        }
+        else
+        {
+            // Discard the rest of the line after a syntax error
+            source->position = NULL;
+            source->pending[0] = '\0';
+        }
+
+        destroy(node);
+    }
+}
+
+/**
+ * Get the next non-empty segment of a source.
+ *
+ * Segments are separated by `SEPARATOR` or follow a `BACKGROUND` operator,
+ * except inside command substitutions.
+ *
+ * @param source A pointer to the source.
+ * @param segment Buffer where the segment is stored, without the separator and
+ * the surrounding blanks.
+ * @param more 1 to read further lines once the last one is consumed, 0 to stop
+ * at the end of the last line.
+ * @return 1 if a segment was stored, 0 if there are no more segments.
+ */
+int next(tsource *source, char segment[], const int more)
+{
+    char *start, *end;
+    int depth, length;
+
+    if (source->pending[0] != '\0')
+    {
+        strcpy(segment, source->pending);
+        source->pending[0] = '\0';
+        return 1;
+    }
+
+    while (1)
+    {
+        if (source->position == NULL)
+        {
+            if (!more || exhausted(&source->shell->input))
+            {
+                return 0;
+            }
+
+            printf(CONTINUATION_PROMPT);
+
+            if (!readLine(source->line, MAXIMUM_LINE_LENGTH, CONTINUATION_PROMPT, source->shell))
+            {
+                return 0;
+            }
+
+            source->position = source->line;
+        }
+
+        for (start = source->position; isspace(*start); start++)
+            ;
+
+        depth = 0;
+
+        for (end = start; *end != '\0' && ((*end != SEPARATOR && (*end != BACKGROUND || (end > start && *(end - 1) == '>'))) || depth > 0); end++)
+        {
+            if (*end == '(' && (depth > 0 || (end > start && *(end - 1) == '$')))
+            {
+                depth++;
+            }
+            else if (*end == ')' && depth > 0)
+            {
+                depth--;
+            }
+        }
+
+        if (*end == BACKGROUND)
+        {
+            // A background command line keeps its `&`
+            source->position = ++end;
+        }
+        else
+        {
+            source->position = *end == SEPARATOR ? end + 1 : NULL;
+        }
+
+        for (length = end - start; length > 0 && isspace(start[length - 1]); length--)
+            ;
+
+        if (length > 0)
+        {
+            memcpy(segment, start, length);
+            segment[length] = '\0';
+            return 1;
+        }
+    }
+}
+
+/**
+ * Check if a segment starts with the given keyword.
+ *
+ * @param segment The segment to be checked.
+ * @param word The keyword.
+ * @param rest Pointer to the variable to store the start of the text following
+ * the keyword, without leading blanks. Ignored if NULL.
+ * @return 1 if the first word of the segment is the keyword, 0 otherwise.
+ */
+int keyword(const char *segment, const char *word, char **rest)
+{
+    int length;
+
+    length = strlen(word);
+
+    if (strncmp(segment, word, length) != 0 || (segment[length] != '\0' && !isspace(segment[length])))
+    {
+        return 0;
+    }
+
+    if (rest != NULL)
+    {
+        for (*rest = (char *)&segment[length]; isspace(**rest); (*rest)++)
+            ;
+    }
+
+    return 1;
+}
+
+/**
+ * Parse the command starting at the given segment, reading the following
+ * segments of the source if it is a compound command.
+ *
+ * @param source A pointer to the source.
+ * @param segment The first segment of the command. It is used as a buffer for
+ * the following segments.
+ * @param node Pointer to the variable to store the parsed node. It may hold a
+ * partially parsed node even if a syntax error is found.
+ * @return 1 if the command was parsed, 0 if it has a syntax error.
+ */
+int statement(tsource *source, char segment[], tnode **node)
+{
+    static const char *reserved[] = {"do", "done", "then", "elif", "else", "fi", NULL};
+    char *rest, *words;
+    int index, length;
+
+    for (index = 0; reserved[index] != NULL; index++)
+    {
+        if (keyword(segment, reserved[index], NULL))
+        {
+            fprintf(stderr, "%s: Syntax error. Unexpected keyword\n", reserved[index]);
+            return 0;
+        }
+    }
+
+    *node = calloc(1, sizeof(tnode));
+
+    if (keyword(segment, "for", &rest))
+    {
+        (*node)->type = FOR_NODE;
+
+        for (length = 0; variable(rest[length], length == 0); length++)
+            ;
+
+        if (length == 0 || !keyword(&rest[length + (rest[length] != '\0')], "in", &words))
+        {
+            fprintf(stderr, "for: Syntax error. Expected NAME in WORDS\n");
+            return 0;
+        }
+
+        (*node)->name = strndup(rest, length);
+        (*node)->text = strdup(words);
+
+        return loop(source, segment, *node);
+    }
+
+    if (keyword(segment, "while", &rest))
+    {
+        (*node)->type = WHILE_NODE;
+        asprintf(&(*node)->text, "%s\n", rest);
+        gather(source, (*node)->text, &(*node)->documents);
+
+        return loop(source, segment, *node);
+    }
+
+    if (keyword(segment, "if", &rest))
+    {
+        (*node)->type = IF_NODE;
+        asprintf(&(*node)->text, "%s\n", rest);
+        gather(source, (*node)->text, &(*node)->documents);
+
+        return conditional(source, segment, *node);
+    }
+
+    (*node)->type = COMMAND_NODE;
+    asprintf(&(*node)->text, "%s\n", segment);
+    gather(source, (*node)->text, &(*node)->documents);
+
+    return 1;
+}
+
+/**
+ * Parse the `do ... done` body of a loop.
+ *
+ * @param source A pointer to the source.
+ * @param segment Buffer for the segments read.
+ * @param node The node of the loop.
+ * @return 1 if the body was parsed, 0 if it has a syntax error.
+ */
+int loop(tsource *source, char segment[], tnode *node)
+{
+    static const char *closing[] = {"done", NULL};
+    char *rest;
+
+    if (!next(source, segment, 1) || !keyword(segment, "do", &rest))
+    {
+        fprintf(stderr, "do: Syntax error. Expected keyword\n");
+        return 0;
+    }
+
+    strcpy(source->pending, rest);
+
+    return block(source, closing, segment, &node->body) && closed(segment, "done");
+}
+
+/**
+ * Parse the `then ... [elif ... | else ...] fi` branches of a conditional.
+ *
+ * @param source A pointer to the source.
+ * @param segment Buffer for the segments read.
+ * @param node The node of the conditional.
+ * @return 1 if the branches were parsed, 0 if they have a syntax error.
+ */
+int conditional(tsource *source, char segment[], tnode *node)
+{
+    static const char *closing[] = {"elif", "else", "fi", NULL};
+    static const char *end[] = {"fi", NULL};
+    char *rest;
+
+    if (!next(source, segment, 1) || !keyword(segment, "then", &rest))
+    {
+        fprintf(stderr, "then: Syntax error. Expected keyword\n");
+        return 0;
+    }
+
+    strcpy(source->pending, rest);
+
+    if (!block(source, closing, segment, &node->body))
+    {
+        return 0;
+    }
+
+    if (keyword(segment, "elif", &rest))
+    {
+        // An `elif` is a conditional nested in the `else` branch
+        node->alternative = calloc(1, sizeof(tnode));
+        node->alternative->type = IF_NODE;
+        asprintf(&node->alternative->text, "%s\n", rest);
+        gather(source, node->alternative->text, &node->alternative->documents);
+
+        return conditional(source, segment, node->alternative);
+    }
+
+    if (keyword(segment, "else", &rest))
+    {
+        strcpy(source->pending, rest);
+
+        if (!block(source, end, segment, &node->alternative))
+        {
+            return 0;
+        }
+    }
+
+    return closed(segment, "fi");
+}
+
+/**
+ * Parse the commands of a source up to one of the given keywords.
+ *
+ * @param source A pointer to the source.
+ * @param closing NULL terminated array of the keywords closing the block.
+ * @param segment Buffer for the segments read. The segment with the closing
+ * keyword is left on it.
+ * @param list Pointer to the variable to store the first node of the block.
+ * @return 1 if the block was parsed, 0 if it has a syntax error.
+ */
+int block(tsource *source, const char *closing[], char segment[], tnode **list)
+{
+    tnode **last;
+    int index;
+
+    last = list;
+
+    while (next(source, segment, 1))
+    {
+        for (index = 0; closing[index] != NULL; index++)
+        {
+            if (keyword(segment, closing[index], NULL))
+            {
+                return 1;
+            }
+        }
+
+        if (!statement(source, segment, last))
+        {
+            return 0;
+        }
+
+        last = &(*last)->next;
+    }
+
+    fprintf(stderr, "%s: Syntax error. Unexpected end of file\n", closing[0]);
+    return 0;
+}
+
+/**
+ * Check that a segment is only made of the keyword closing a compound command.
+ *
+ * @param segment The segment with the closing keyword.
+ * @param word The closing keyword.
+ * @return 1 if nothing follows the keyword, 0 otherwise.
+ */
+int closed(const char *segment, const char *word)
+{
+    char *rest;
+
+    if (!keyword(segment, word, &rest) || *rest != '\0')
+    {
+        fprintf(stderr, "%s: Syntax error. Expected keyword\n", word);
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Read the bodies of the here-documents `<<WORD` of a parsed command line.
+ *
+ * Each body is read from the following lines up to the one equal to `WORD`,
+ * when the command line is parsed, so the lines of a body are never parsed as
+ * commands and a command line executed several times, like the ones of a loop,
+ * does not read its bodies again. Operators without a word are reported when
+ * the command line is executed.
+ *
+ * @param source A pointer to the source the command line was read from.
+ * @param text The command line.
+ * @param documents Pointer to the variable to store the NULL terminated array
+ * of bodies. It is left untouched if the command line has no here-documents.
+ */
+void gather(tsource *source, const char *text, char ***documents)
+{
+    char line[MAXIMUM_LINE_LENGTH];
+    char *operator, *start, *end;
+    char *word, *body;
+    int quoted, size, length, capacity, written;
+
+    size = 0;
+
+    for (operator = nextHeredoc(text, &start, &end); operator != NULL; operator = nextHeredoc(end, &start, &end))
+    {
+        if (strncmp(operator, HERESTRING, strlen(HERESTRING)) == 0 || end == start)
+        {
+            continue;
+        }
+
+        quoted = end - start > 1 && (*start == '\'' || *start == '"') && *(end - 1) == *start;
+        word = strndup(start + quoted, end - start - 2 * quoted);
+
+        length = 0;
+        capacity = MAXIMUM_LINE_LENGTH;
+        body = malloc(capacity);
+
+        while (!exhausted(&source->shell->input) && printf(CONTINUATION_PROMPT) && readLine(line, MAXIMUM_LINE_LENGTH, CONTINUATION_PROMPT, source->shell))
+        {
+            if (strncmp(line, word, strlen(word)) == 0 && strcspn(&line[strlen(word)], "\n") == 0)
+            {
+                break;
+            }
+
+            written = strlen(line);
+            reserve(&body, &capacity, length + written + 1);
+
+            memcpy(&body[length], line, written);
+            length += written;
+        }
+
+        body[length] = '\0';
+        free(word);
+
+        *documents = realloc(*documents, sizeof(char *) * (size + 2));
+        (*documents)[size++] = body;
+        (*documents)[size] = NULL;
+    }
+}
+
+/**
+ * Execute a list of parsed nodes.
+ *
+ * The list stops being executed if a command is interrupted with `Ctrl+C`, so
+ * loops can be cancelled.
+ *
+ * @param node The first node of the list.
+ * @param shell A pointer to the structure representing the shell state.
+ * @return The exit status of the last command line executed.
+ */
+int execute(const tnode *node, tshell *shell)
+{
+    char *words, *word, *position;
+    char **list;
+    int status, size, capacity, index;
+
+    status = EXIT_SUCCESS;
+
+    for (; node != NULL && status != SIGNAL_STATUS + SIGINT; node = node->next)
+    {
+        if (node->type == COMMAND_NODE)
+        {
+            status = evaluate(node->text, node->documents, shell);
+            remember(status, shell);
+        }
+        else if (node->type == FOR_NODE)
+        {
+            words = expand(node->text, shell);
+
+            if (words == NULL)
+            {
+                status = EXIT_FAILURE;
+                remember(status, shell);
+                continue;
+            }
+
+            status = EXIT_SUCCESS;
+            capacity = FOR_WORDS_CAPACITY;
+            list = malloc(sizeof(char *) * capacity);
+            size = 0;
+
+            // Words are expanded as filename patterns, like command arguments
+            for (word = strtok_r(words, BLANKS, &position); word != NULL; word = strtok_r(NULL, BLANKS, &position))
+            {
+                expandPattern(word, &list, &size, &capacity);
+            }
+
+            for (index = 0; index < size && status != SIGNAL_STATUS + SIGINT; index++)
+            {
+                assign(&shell->variables, node->name, strlen(node->name), list[index], 0);
+                status = execute(node->body, shell);
+            }
+
+            for (index = 0; index < size; index++)
+            {
+                free(list[index]);
+            }
+
+            free(list);
+            free(words);
+            remember(status, shell);
+        }
+        else if (node->type == WHILE_NODE)
+        {
+            status = EXIT_SUCCESS;
+
+            while (status != SIGNAL_STATUS + SIGINT)
+            {
+                status = evaluate(node->text, node->documents, shell);
+                remember(status, shell);
+
+                if (status != EXIT_SUCCESS)
+                {
+                    // A condition that is not met does not fail the loop
+                    status = status == SIGNAL_STATUS + SIGINT ? status : EXIT_SUCCESS;
+                    break;
+                }
+
+                status = execute(node->body, shell);
+            }
+
+            remember(status, shell);
+        }
+        else if (node->type == IF_NODE)
+        {
+            status = evaluate(node->text, node->documents, shell);
+            remember(status, shell);
+
+            if (status == EXIT_SUCCESS)
+            {
+                status = execute(node->body, shell);
+            }
+            else if (status != SIGNAL_STATUS + SIGINT)
+            {
+                status = execute(node->alternative, shell);
+            }
+
+            // The status of a compound command is the one of the whole node
+            remember(status, shell);
+        }
+    }
+
+    return status;
+}
+
+/**
+ * Store an exit status in the `STATUS` variable.
+ *
+ * @param status The exit status.
+ * @param shell A pointer to the structure representing the shell state.
+ */
+void remember(const int status, tshell *shell)
+{
+    char value[MAXIMUM_LINE_LENGTH];
+
+    snprintf(value, MAXIMUM_LINE_LENGTH, "%i", status);
+    assign(&shell->variables, STATUS, strlen(STATUS), value, 0);
+}
+
+/**
+ * Free a list of parsed nodes and all their descendants.
+ *
+ * @param node The first node of the list.
+ */
+void destroy(tnode *node)
+{
+    tnode *following;
+    int index;
+
+    for (; node != NULL; node = following)
+    {
+        following = node->next;
+
+        destroy(node->body);
+        destroy(node->alternative);
+
+        for (index = 0; node->documents != NULL && node->documents[index] != NULL; index++)
+        {
+            free(node->documents[index]);
+        }
+
+        free(node->documents);
+        free(node->text);
+        free(node->name);
+        free(node);
+    }
+}
+
+/**
+ * Expand, parse and execute a command line, dispatching internal commands to
+ * their implementation and everything else to `executeExternalCommands`.
+ *
+ * Command lines are planned before their variables are expanded, so a line
+ * run with different values, like the body of a loop, is parsed only once,
+ * and its arguments are expanded in the plan. Command lines with command
+ * substitutions or with variables in a command name are expanded first and
+ * then planned.
+ *
+ * @param buffer The command line instruction as typed by the user.
+ * @param documents NULL terminated array of the bodies of the here-documents
+ * of the command line, or NULL if it has none.
+ * @param shell A pointer to the structure representing the shell state.
+ * @return The exit status of the command line.
+ */
+int evaluate(const char buffer[], char *documents[], tshell *shell)
+{
+    char *text, *expanded;
+    tline *line, *source;
+    tline arguments, globbed;
+    tplan *current;
+    char **firstCommandArguments;
+    int input, dynamic, patterns;
+    int status;
+
+    text = strdup(buffer);
+    shell->substitution = EXIT_SUCCESS;
+
+    if (!heredoc(text, documents, &input, shell))
+    {
+        free(text);
+        return EXIT_FAILURE;
+    }
+
+    dynamic = strstr(text, "$(") != NULL;
+    current = dynamic ? NULL : plan(text, shell);
+
+    if (dynamic || (current != NULL && current->dynamic))
+    {
+        dynamic = 1;
+        expanded = expand(text, shell);
+
+        free(text);
+        text = expanded;
+
+        current = text == NULL ? NULL : plan(text, shell);
+    }
+
+    free(text);
+
+    if (current == NULL)
+    {
+        if (input != NO_INPUT)
+        {
+            close(input);
+        }
+        return EXIT_FAILURE;
+    }
+
+    source = &current->line;
+    patterns = current->patterns;
+
+    if (current->expansions && !dynamic)
+    {
+        if (!expandArguments(&current->line, &arguments, shell))
+        {
+            if (input != NO_INPUT)
+            {
+                close(input);
+            }
+            return EXIT_FAILURE;
+        }
+
+        source = &arguments;
+        patterns = wildcards(source);
+    }
+
+    if (patterns)
+    {
+        expandPatterns(source, &globbed);
+        line = &globbed;
+    }
+    else
+    {
+        line = source;
+    }
+
+    firstCommandArguments = line->commands[0].argv;
+    status = EXIT_SUCCESS;
+
+    if (!current->internal)
+    {
+        status = executeExternalCommands(line, shell, buffer, input);
+    }
+    else if (strcmp(firstCommandArguments[COMMAND], "cd") == 0)
+    {
+        mshcd(firstCommandArguments[DIRECTORY], &shell->variables);
+    }
+    else if (strcmp(firstCommandArguments[COMMAND], "umask") == 0)
+    {
+        mshumask(firstCommandArguments[MASK], &shell->formattedMask);
+    }
+    else if (strcmp(firstCommandArguments[COMMAND], "exit") == 0)
+    {
+        mshexit(&shell->jobs);
+    }
+    else if (strcmp(firstCommandArguments[COMMAND], "jobs") == 0)
+    {
+        mshjobs(&firstCommandArguments[COMMAND + 1], &shell->jobs);
+    }
+    else if (strcmp(firstCommandArguments[COMMAND], "fg") == 0)
+    {
+        mshfg(firstCommandArguments[JOB], &shell->jobs);
+    }
+    else if (strcmp(firstCommandArguments[COMMAND], "pipesize") == 0)
+    {
+        mshpipesize(firstCommandArguments[SIZE], &shell->pipeSize);
+    }
+    else if (strcmp(firstCommandArguments[COMMAND], "jobbuffer") == 0)
+    {
+        mshjobbuffer(firstCommandArguments[BUFFER_MODE], &shell->jobOutput);
+    }
+    else if (strcmp(firstCommandArguments[COMMAND], "metrics") == 0)
+    {
+        mshmetrics(firstCommandArguments[ENDPOINT], &shell->jobs);
+    }
+    else if (strcmp(firstCommandArguments[COMMAND], "export") == 0)
+    {
+        mshexport(&firstCommandArguments[COMMAND + 1], &shell->variables);
+    }
+    else if (strcmp(firstCommandArguments[COMMAND], "unset") == 0)
+    {
+        mshunset(&firstCommandArguments[COMMAND + 1], &shell->variables);
+    }
+    else if (strcmp(firstCommandArguments[COMMAND], "wait") == 0)
+    {
+        status = mshwait(&firstCommandArguments[COMMAND + 1], &shell->jobs);
+    }
+    else if (line->ncommands == 1 && assignment(firstCommandArguments[COMMAND]))
+    {
+        // Without a command, the status is the one of the last substitution
+        mshassign(firstCommandArguments, &shell->variables);
+        status = shell->substitution;
+    }
+    else
+    {
+        status = executeExternalCommands(line, shell, buffer, input);
+    }
+
+    if (input != NO_INPUT)
+    {
+        close(input);
+    }
+
+    if (patterns)
+    {
+        releasePatterns(&globbed, source);
+    }
+
+    if (source == &arguments)
+    {
+        release(&arguments);
+    }
+
+    return status;
+}
+
+/**
+ * Get the execution plan of a command line, parsing it and storing its plan in
+ * the cache the first time it is seen.
+ *
+ * Plans hold the commands resolved with the current `PATH`, so the cache is
+ * emptied whenever `PATH` changes. The cache doubles once half full until it
+ * reaches `MAXIMUM_PLAN_CACHE_CAPACITY` slots; from then on, plans not used
+ * since the previous eviction make room for new ones.
+ *
+ * @param key The command line, whose variables may not be expanded yet.
+ * @param shell A pointer to the structure representing the shell state.
+ * @return The execution plan, or NULL if the command line is empty or has a
+ * syntax error.
+ */
+tplan *plan(const char *key, tshell *shell)
+{
+    tplans *plans;
+    tplan *current;
+    tline *line;
+    char *path, *name;
+    int index, command, argument;
+
+    plans = &shell->plans;
+    path = lookup(&shell->variables, PATH, strlen(PATH));
+
+    if (plans->size > 0 && (path == NULL || plans->path == NULL || strcmp(path, plans->path) != 0))
+    {
+        flush(plans);
+    }
+
+    index = probe(plans, key);
+
+    if (plans->list[index].key != NULL)
+    {
+        plans->list[index].used = 1;
+        return &plans->list[index];
+    }
+
+    // Commands are resolved with the `PATH` of the exported variables
+    environment(&shell->variables);
+
+    line = tokenize((char *)key);
+
+    if (line == NULL || line->ncommands < 1)
+    {
+        return NULL;
+    }
+
+    // Keep the load factor under one half so probe sequences stay short
+    if ((plans->size + 1) * 2 > plans->capacity)
+    {
+        if (plans->capacity < MAXIMUM_PLAN_CACHE_CAPACITY)
+        {
+            rehash(plans, plans->capacity * 2, 0);
+        }
+        else
+        {
+            rehash(plans, plans->capacity, 1);
+
+            // Most plans are in use, so start again from an empty cache
+            if ((plans->size + 1) * 2 > plans->capacity)
+            {
+                flush(plans);
+            }
+        }
+
+        index = probe(plans, key);
+    }
+
+    if (plans->path == NULL && path != NULL)
+    {
+        plans->path = strdup(path);
+    }
+
+    current = &plans->list[index];
+    current->key = strdup(key);
+    copy(&current->line, line);
+    current->internal = line->ncommands == 1 && (internal(line->commands[0].argv[COMMAND]) || assignment(line->commands[0].argv[COMMAND]));
+    current->patterns = wildcards(line);
+    current->expansions = (line->redirect_input != NULL && strchr(line->redirect_input, '$') != NULL) || (line->redirect_output != NULL && strchr(line->redirect_output, '$') != NULL) || (line->redirect_error != NULL && strchr(line->redirect_error, '$') != NULL);
+    current->dynamic = 0;
+    current->used = 0;
+
+    for (command = 0; command < line->ncommands; command++)
+    {
+        name = line->commands[command].argv[COMMAND];
+        current->dynamic = current->dynamic || (strchr(name, '$') != NULL && !assignment(name));
+
+        for (argument = 0; argument < line->commands[command].argc; argument++)
+        {
+            current->expansions = current->expansions || strchr(line->commands[command].argv[argument], '$') != NULL;
+        }
+    }
+    plans->size++;
+
+    return current;
+}
+
+/**
+ * Check if a command is an internal command of the shell.
+ *
+ * @param command The name of the command.
+ * @return 1 if the command is implemented by the shell, 0 otherwise.
+ */
+int internal(const char *command)
+{
+    const char **commands;
+    int index;
+
+    commands = builtins();
+
+    for (index = 0; commands[index] != NULL; index++)
+    {
+        if (strcmp(command, commands[index]) == 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Get the names of the internal commands of the shell.
+ *
+ * @return NULL terminated array of the names.
+ */
+const char **builtins(void)
+{
+    static const char *commands[] = {"cd", "umask", "exit", "jobs", "fg", "pipesize", "export", "unset", "wait", "jobbuffer", "metrics", NULL};
+
+    return commands;
+}
+
+/**
+ * Copy a parsed command line, which the parser overwrites on every call.
+ *
+ * @param destination Pointer to the structure where the copy is stored.
+ * @param source A pointer to the command line to be copied.
+ */
+void copy(tline *destination, const tline *source)
+{
+    int command, argument;
+    tcommand *current;
+
+    *destination = *source;
+    destination->commands = malloc(sizeof(tcommand) * source->ncommands);
+
+    for (command = 0; command < source->ncommands; command++)
+    {
+        current = &destination->commands[command];
+        *current = source->commands[command];
+
+        current->filename = current->filename == NULL ? NULL : strdup(current->filename);
+        current->argv = malloc(sizeof(char *) * (current->argc + 1));
+
+        for (argument = 0; argument < current->argc; argument++)
+        {
+            current->argv[argument] = strdup(source->commands[command].argv[argument]);
+        }
+        current->argv[current->argc] = NULL;
+    }
+
+    destination->redirect_input = source->redirect_input == NULL ? NULL : strdup(source->redirect_input);
+    destination->redirect_output = source->redirect_output == NULL ? NULL : strdup(source->redirect_output);
+    destination->redirect_error = source->redirect_error == NULL ? NULL : strdup(source->redirect_error);
+}
+
+/**
+ * Expand the filename patterns of the arguments of a command line.
+ *
+ * The expanded command line shares everything with the source but the
+ * arguments of the commands with patterns, which are replaced by the sorted
+ * names matching each pattern. Patterns matching no name are kept as they are.
+ *
+ * @param source A pointer to the command line whose patterns are expanded.
+ * @param destination Pointer to the structure where the expanded command line
+ * is stored. It must be freed with `releasePatterns`.
+ */
+void expandPatterns(const tline *source, tline *destination)
+{
+    tcommand *current;
+    char **arguments;
+    int command, argument, size, capacity;
+
+    *destination = *source;
+    destination->commands = malloc(sizeof(tcommand) * source->ncommands);
+
+    for (command = 0; command < source->ncommands; command++)
+    {
+        current = &destination->commands[command];
+        *current = source->commands[command];
+
+        capacity = current->argc + 1;
+        arguments = malloc(sizeof(char *) * capacity);
+        arguments[COMMAND] = strdup(current->argv[COMMAND]);
+        size = 1;
+
+        for (argument = 1; argument < current->argc; argument++)
+        {
+            expandPattern(current->argv[argument], &arguments, &size, &capacity);
+        }
+
+        arguments[size] = NULL;
+
+        current->argv = arguments;
+        current->argc = size;
+    }
+}
+
+/**
+ * Append the sorted names matching a filename pattern to an array of words,
+ * or the word itself if it is not a pattern or matches no name.
+ *
+ * @param word The word to be expanded.
+ * @param matches Pointer to the array of words, which may be reallocated.
+ * @param size Pointer to the number of words of the array.
+ * @param capacity Pointer to the capacity of the array.
+ */
+void expandPattern(const char *word, char ***matches, int *size, int *capacity)
+{
+    tpattern pattern;
+    int first;
+
+    first = *size;
+
+    if (strpbrk(word, WILDCARDS) != NULL && compilePattern(word, &pattern))
+    {
+        scanDirectory(&pattern, matches, size, capacity);
+
+        free(pattern.directory);
+        free(pattern.symbols);
+        free(pattern.suffix);
+    }
+
+    if (*size == first)
+    {
+        if (*size + 1 >= *capacity)
+        {
+            *capacity *= 2;
+            *matches = realloc(*matches, sizeof(char *) * *capacity);
+        }
+
+        (*matches)[(*size)++] = strdup(word);
+    }
+    else
+    {
+        qsort(&(*matches)[first], *size - first, sizeof(char *), compareNames);
+    }
+}
+
+/**
+ * Free a command line expanded with `expandPatterns`.
+ *
+ * @param expanded A pointer to the expanded command line.
+ * @param source A pointer to the command line it was expanded from.
+ */
+void releasePatterns(tline *expanded, const tline *source)
+{
+    int command, argument;
+
+    for (command = 0; command < source->ncommands; command++)
+    {
+        for (argument = 0; argument < expanded->commands[command].argc; argument++)
+        {
+            free(expanded->commands[command].argv[argument]);
+        }
+        free(expanded->commands[command].argv);
+    }
+
+    free(expanded->commands);
+}
+
+/**
+ * Expand the variables of the words of a parsed command line.
+ *
+ * Expanded arguments are split into words at blanks, so an argument expanding
+ * to nothing is removed. Command names, `NAME=VALUE` words and redirection
+ * filenames are expanded without being split, and a redirection filename
+ * expanding to nothing is an error.
+ *
+ * @param source A pointer to the parsed command line.
+ * @param destination Pointer to the structure where the expanded command line
+ * is stored. It must be freed with `release`, unless the expansion failed.
+ * @param shell A pointer to the structure representing the shell state.
+ * @return 1 if every word was expanded, 0 otherwise.
+ */
+int expandArguments(const tline *source, tline *destination, tshell *shell)
+{
+    const char *files[] = {source->redirect_input, source->redirect_output, source->redirect_error};
+    char **targets[] = {&destination->redirect_input, &destination->redirect_output, &destination->redirect_error};
+    tcommand *current;
+    char **arguments;
+    char *word, *value;
+    int command, argument, size, capacity, index, failed;
+
+    *destination = *source;
+    destination->commands = malloc(sizeof(tcommand) * source->ncommands);
+    destination->redirect_input = NULL;
+    destination->redirect_output = NULL;
+    destination->redirect_error = NULL;
+    failed = 0;
+
+    for (command = 0; command < source->ncommands && !failed; command++)
+    {
+        current = &destination->commands[command];
+        *current = source->commands[command];
+        current->filename = current->filename == NULL ? NULL : strdup(current->filename);
+
+        capacity = current->argc + 1;
+        arguments = malloc(sizeof(char *) * capacity);
+        size = 0;
+
+        for (argument = 0; argument < current->argc && !failed; argument++)
+        {
+            word = current->argv[argument];
+            value = strchr(word, '$') == NULL ? strdup(word) : expand(word, shell);
+
+            if (value == NULL)
+            {
+                failed = 1;
+            }
+            else if (argument == COMMAND || strchr(word, '$') == NULL || assignment(word))
+            {
+                if (size + 1 >= capacity)
+                {
+                    capacity *= 2;
+                    arguments = realloc(arguments, sizeof(char *) * capacity);
+                }
+
+                arguments[size++] = value;
+            }
+            else
+            {
+                split(value, &arguments, &size, &capacity);
+                free(value);
+            }
+        }
+
+        arguments[size] = NULL;
+
+        current->argv = arguments;
+        current->argc = size;
+        destination->ncommands = command + 1;
+    }
+
+    for (index = 0; index < (int)(sizeof(files) / sizeof(files[0])) && !failed; index++)
+    {
+        if (files[index] != NULL)
+        {
+            *targets[index] = strchr(files[index], '$') == NULL ? strdup(files[index]) : expand(files[index], shell);
+            failed = *targets[index] == NULL;
+
+            if (!failed && **targets[index] == '\0')
+            {
+                fprintf(stderr, "%s: Error. Ambiguous redirect\n", files[index]);
+                failed = 1;
+            }
+        }
+    }
+
+    if (failed)
+    {
+        release(destination);
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Split the result of an expansion into words, appending them to an array of
+ * arguments.
+ *
+ * @param value The result of the expansion, modified in place.
+ * @param arguments Pointer to the array of arguments, which may be moved.
+ * @param size Pointer to the number of arguments of the array.
+ * @param capacity Pointer to the capacity of the array.
+ */
+void split(char *value, char ***arguments, int *size, int *capacity)
+{
+    char *word, *position;
+
+    for (word = strtok_r(value, BLANKS, &position); word != NULL; word = strtok_r(NULL, BLANKS, &position))
+    {
+        if (*size + 1 >= *capacity)
+        {
+            *capacity *= 2;
+            *arguments = realloc(*arguments, sizeof(char *) * *capacity);
+        }
+
+        (*arguments)[(*size)++] = strdup(word);
+    }
+}
+
+/**
+ * Check if some argument of a command line is a filename pattern.
+ *
+ * @param line A pointer to the command line.
+ * @return 1 if an argument other than a command name has wildcards, 0
+ * otherwise.
+ */
+int wildcards(const tline *line)
+{
+    int command, argument;
+
+    for (command = 0; command < line->ncommands; command++)
+    {
+        for (argument = 1; argument < line->commands[command].argc; argument++)
+        {
+            if (strpbrk(line->commands[command].argv[argument], WILDCARDS) != NULL)
+            {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Compile a filename pattern into a matcher.
+ *
+ * Supported wildcards are `*`, `?` and character classes such as `[abc]`,
+ * `[a-z]` or `[!0-9]`. A `[` without its closing `]` is a literal character.
+ *
+ * @param argument The filename pattern.
+ * @param pattern Pointer to the structure where the compiled pattern is
+ * stored.
+ * @return 1 if the pattern was compiled, 0 if it has wildcards outside its
+ * last component.
+ */
+int compilePattern(const char *argument, tpattern *pattern)
+{
+    const char *component, *character, *end;
+    tsymbol *symbol;
+    int length, negated, first, last, bit;
+
+    length = strlen(argument);
+
+    pattern->directories = length > 1 && argument[length - 1] == '/';
+    length -= pattern->directories;
+
+    for (component = &argument[length]; component > argument && *(component - 1) != '/'; component--)
+        ;
+
+    pattern->directory = strndup(argument, component - argument);
+
+    if (strpbrk(pattern->directory, WILDCARDS) != NULL)
+    {
+        free(pattern->directory);
+        return 0;
+    }
+
+    pattern->symbols = malloc(sizeof(tsymbol) * (length + 1));
+    pattern->size = 0;
+    pattern->hidden = *component == '.';
+
+    for (character = component; character < &argument[length]; character++)
+    {
+        symbol = &pattern->symbols[pattern->size++];
+        negated = character[1] == '!' || character[1] == '^';
+
+        // The closing bracket may not be the first character of the class
+        for (end = character + 1 + negated + 1; end < &argument[length] && *end != ']'; end++)
+            ;
+
+        if (*character == '*')
+        {
+            symbol->type = STAR_SYMBOL;
+        }
+        else if (*character == '?')
+        {
+            symbol->type = ANY_SYMBOL;
+        }
+        else if (*character == '[' && end < &argument[length])
+        {
+            symbol->type = CLASS_SYMBOL;
+            memset(symbol->set, 0, sizeof(symbol->set));
+
+            for (character += 1 + negated; character < end; character++)
+            {
+                first = (unsigned char)*character;
+                last = first;
+
+                if (character[1] == '-' && character + 2 < end)
+                {
+                    last = (unsigned char)character[2];
+                    character += 2;
+                }
+
+                for (bit = first; bit <= last; bit++)
+                {
+                    symbol->set[bit / 8] |= 1 << (bit % 8);
+                }
+            }
+
+            for (bit = 0; negated && bit < (int)sizeof(symbol->set); bit++)
+            {
+                symbol->set[bit] = ~symbol->set[bit];
+            }
+        }
+        else
+        {
+            symbol->type = LITERAL_SYMBOL;
+            symbol->character = *character;
+        }
+    }
+
+    for (pattern->prefix = 0; pattern->prefix < pattern->size && pattern->symbols[pattern->prefix].type == LITERAL_SYMBOL; pattern->prefix++)
+        ;
+
+    // Literal characters after the last `*` must end every matching name
+    for (length = pattern->size; length > 0 && pattern->symbols[length - 1].type == LITERAL_SYMBOL; length--)
+        ;
+
+    if (length > 0 && pattern->symbols[length - 1].type == STAR_SYMBOL)
+    {
+        pattern->suffix = malloc(pattern->size - length + 1);
+
+        for (last = length; last < pattern->size; last++)
+        {
+            pattern->suffix[last - length] = pattern->symbols[last].character;
+        }
+        pattern->suffix[pattern->size - length] = '\0';
+    }
+    else
+    {
+        pattern->suffix = NULL;
+    }
+
+    return 1;
+}
+
+/**
+ * Check if a name matches a compiled filename pattern.
+ *
+ * The literal prefix and suffix of the pattern are checked first, so most
+ * names that do not match are rejected without running the matcher.
+ *
+ * @param pattern A pointer to the compiled pattern.
+ * @param name The name to be checked.
+ * @return 1 if the name matches the pattern, 0 otherwise.
+ */
+int matchPattern(const tpattern *pattern, const char *name)
+{
+    const tsymbol *symbols, *symbol;
+    const char *character, *restart;
+    int index, star, length, suffixLength;
+
+    symbols = pattern->symbols;
+
+    for (index = 0; index < pattern->prefix; index++)
+    {
+        if ((unsigned char)name[index] != symbols[index].character)
+        {
+            return 0;
+        }
+    }
+
+    if (pattern->suffix != NULL)
+    {
+        length = strlen(name);
+        suffixLength = strlen(pattern->suffix);
+
+        if (length < suffixLength || memcmp(&name[length - suffixLength], pattern->suffix, suffixLength) != 0)
+        {
+            return 0;
+        }
+    }
+
+    // Backtrack to the last `*` when a symbol does not match
+    star = -1;
+    restart = NULL;
+
+    for (character = &name[index]; *character != '\0';)
+    {
+        symbol = &symbols[index];
+
+        if (index < pattern->size && symbol->type == STAR_SYMBOL)
+        {
+            star = index++;
+            restart = character;
+        }
+        else if (index < pattern->size && (symbol->type == ANY_SYMBOL || (symbol->type == LITERAL_SYMBOL && symbol->character == (unsigned char)*character) || (symbol->type == CLASS_SYMBOL && symbol->set[(unsigned char)*character / 8] & (1 << ((unsigned char)*character % 8)))))
+        {
+            index++;
+            character++;
+        }
+        else if (star >= 0)
+        {
+            index = star + 1;
+            character = ++restart;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+
+    while (index < pattern->size && symbols[index].type == STAR_SYMBOL)
+    {
+        index++;
+    }
+
+    return index == pattern->size;
+}
+
+/**
+ * Append the paths of the entries of a directory matching a compiled filename
+ * pattern to an array of arguments.
+ *
+ * Entries are read with `getdents64` into a large buffer, and their type is
+ * taken from the entry itself, so they only need to be `stat`ed when the
+ * pattern only matches directories and the file system does not report it.
+ *
+ * @param pattern A pointer to the compiled pattern.
+ * @param matches Pointer to the array of arguments, which may be reallocated.
+ * @param size Pointer to the number of arguments of the array.
+ * @param capacity Pointer to the capacity of the array.
+ * @return The number of matching entries.
+ */
+int scanDirectory(const tpattern *pattern, char ***matches, int *size, int *capacity)
+{
+    static char buffer[DIRECTORY_BUFFER_SIZE];
+    struct dirent64 *entry;
+    struct stat status;
+    int fd, bytes, offset, found, directory;
+
+    fd = open(pattern->directory[0] == '\0' ? "." : pattern->directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return 0;
+    }
+
+    found = 0;
+
+    while ((bytes = getdents64(fd, buffer, DIRECTORY_BUFFER_SIZE)) > 0)
+    {
+        for (offset = 0; offset < bytes; offset += entry->d_reclen)
+        {
+            entry = (struct dirent64 *)&buffer[offset];
+
+            if ((entry->d_name[0] == '.' && !pattern->hidden) || !matchPattern(pattern, entry->d_name))
+            {
+                continue;
+            }
+
+            if (pattern->directories)
+            {
+                directory = entry->d_type == DT_DIR;
+
+                if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK)
+                {
+                    directory = fstatat(fd, entry->d_name, &status, 0) == 0 && S_ISDIR(status.st_mode);
+                }
+
+                if (!directory)
+                {
+                    continue;
+                }
+            }
+
+            if (*size + 1 >= *capacity)
+            {
+                *capacity *= 2;
+                *matches = realloc(*matches, sizeof(char *) * *capacity);
+            }
+
+            asprintf(&(*matches)[(*size)++], "%s%s%s", pattern->directory, entry->d_name, pattern->directories ? "/" : "");
+            found++;
+        }
+    }
+
+    close(fd);
+
+    return found;
+}
+
+/**
+ * Compare two names for sorting them with `qsort`.
+ *
+ * @param first Pointer to the first name.
+ * @param second Pointer to the second name.
+ * @return A negative, zero or positive value if the first name sorts before,
+ * equal to or after the second one.
+ */
+int compareNames(const void *first, const void *second)
+{
+    return strcmp(*(char *const *)first, *(char *const *)second);
+}
+
+/**
+ * Free a command line copied with `copy`.
+ *
+ * @param line A pointer to the command line to be freed.
+ */
+void release(tline *line)
+{
+    int command, argument;
+
+    for (command = 0; command < line->ncommands; command++)
+    {
+        for (argument = 0; argument < line->commands[command].argc; argument++)
+        {
+            free(line->commands[command].argv[argument]);
+        }
+        free(line->commands[command].argv);
+        free(line->commands[command].filename);
+    }
+
+    free(line->commands);
+    free(line->redirect_input);
+    free(line->redirect_output);
+    free(line->redirect_error);
+}
+
+/**
+ * Remove every execution plan from the cache.
+ *
+ * @param plans A pointer to the cache of execution plans.
+ */
+void flush(tplans *plans)
+{
+    int index;
+
+    for (index = 0; index < plans->capacity && plans->size > 0; index++)
+    {
+        if (plans->list[index].key != NULL)
+        {
+            free(plans->list[index].key);
+            release(&plans->list[index].line);
+            plans->list[index].key = NULL;
+            plans->size--;
+        }
+    }
+
+    free(plans->path);
+    plans->path = NULL;
+}
+
+/**
+ * Find the slot of a command line in the cache of execution plans.
+ *
+ * @param plans A pointer to the cache of execution plans.
+ * @param key The expanded command line.
+ * @return The index of the slot holding the plan of the command line, or of
+ * the empty slot where it would be stored.
+ */
+int probe(const tplans *plans, const char *key)
+{
+    int mask, index;
+
+    mask = plans->capacity - 1;
+
+    for (index = hash(key, strlen(key)) & mask; plans->list[index].key != NULL; index = (index + 1) & mask)
+    {
+        if (strcmp(plans->list[index].key, key) == 0)
+        {
+            return index;
+        }
+    }
+
+    return index;
+}
+
+/**
+ * Move every execution plan to its slot in a new table.
+ *
+ * When evicting, plans not used since the previous eviction are removed, and
+ * the remaining ones are marked as unused so they have to be used again to
+ * survive the next eviction.
+ *
+ * @param plans A pointer to the cache of execution plans.
+ * @param capacity The number of slots of the new table, a power of two.
+ * @param evict Flag indicating whether unused plans are removed.
+ */
+void rehash(tplans *plans, const int capacity, const int evict)
+{
+    tplan *list;
+    int previous, index;
+
+    list = plans->list;
+    previous = plans->capacity;
+
+    plans->capacity = capacity;
+    plans->list = calloc(plans->capacity, sizeof(tplan));
+
+    for (index = 0; index < previous; index++)
+    {
+        if (list[index].key == NULL)
+        {
+            continue;
+        }
+
+        if (evict && !list[index].used)
+        {
+            free(list[index].key);
+            release(&list[index].line);
+            plans->size--;
+        }
+        else
+        {
+            list[index].used = list[index].used && !evict;
+            plans->list[probe(plans, list[index].key)] = list[index];
+        }
+    }
+
+    free(list);
+}
+
+/**
+ * Extract the here-documents `<<WORD` and here-strings `<<<WORD` of a command
+ * line and prepare the standard input they provide.
+ *
+ * Operators are removed from the command line so it can be parsed. The bodies
+ * of here-documents were read when the command line was parsed, and they and
+ * the words of here-strings have their variables and command substitutions
+ * expanded unless `WORD` is quoted. If several operators are used, the last
+ * one provides the input.
+ *
+ * @param line The command line, modified in place.
+ * @param documents NULL terminated array of the bodies of the here-documents
+ * of the command line, or NULL if it has none.
+ * @param input Pointer to the variable to store the file descriptor to be read
+ * as standard input, or `NO_INPUT` if there is none.
+ * @param shell A pointer to the structure representing the shell state.
+ * @return 1 if the operators were processed, 0 otherwise.
+ */
+int heredoc(char line[], char *documents[], int *input, tshell *shell)
+{
+    char *operator, *start, *end;
+    char *body, *expanded;
+    int string, quoted, index, length;
+
+    *input = NO_INPUT;
+    index = 0;
+
+    for (operator = nextHeredoc(line, &start, &end); operator != NULL; operator = nextHeredoc(end, &start, &end))
+    {
+        string = strncmp(operator, HERESTRING, strlen(HERESTRING)) == 0;
+
+        if (end == start)
+        {
+            fprintf(stderr, "%s: Error. Missing word\n", string ? HERESTRING : HEREDOC);
+
+            if (*input != NO_INPUT)
+            {
+                close(*input);
+            }
+            return 0;
+        }
+
+        quoted = end - start > 1 && (*start == '\'' || *start == '"') && *(end - 1) == *start;
+
+        if (string)
+        {
+            body = strndup(start + quoted, end - start - 2 * quoted);
+        }
+        else
+        {
+            body = strdup(documents != NULL && documents[index] != NULL ? documents[index++] : "");
+        }
+
+        memset(operator, ' ', end - operator);
+
+        expanded = quoted ? NULL : expand(body, shell);
+
+        if (expanded != NULL)
+        {
+            free(body);
+            body = expanded;
+        }
+
+        length = strlen(body);
+
+        if (string)
+        {
+            body = realloc(body, length + 2);
+            body[length++] = '\n';
+        }
+
+        if (*input != NO_INPUT)
+        {
+            close(*input);
+        }
+
+        *input = feed(body, length, shell->pipeSize);
+        free(body);
+
+        if (*input == NO_INPUT)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Find the next here-document `<<WORD` or here-string `<<<WORD` operator of a
+ * command line, skipping the ones inside command substitutions.
+ *
+ * @param text The command line.
+ * @param start Pointer to the variable to store the start of `WORD`.
+ * @param end Pointer to the variable to store the end of `WORD`, which is
+ * equal to its start if the operator has no word.
+ * @return A pointer to the operator, or NULL if there are no more operators.
+ */
+char *nextHeredoc(const char *text, char **start, char **end)
+{
+    char *operator;
+    int depth;
+
+    depth = 0;
+
+    for (operator = (char *)text; *operator != '\0'; operator++)
+    {
+        if (*operator == '(' && (depth > 0 || (operator > text && *(operator - 1) == '$')))
+        {
+            depth++;
+        }
+        else if (*operator == ')' && depth > 0)
+        {
+            depth--;
+        }
+        else if (depth == 0 && strncmp(operator, HEREDOC, strlen(HEREDOC)) == 0)
+        {
+            break;
+        }
+    }
+
+    if (*operator == '\0')
+    {
+        return NULL;
+    }
+
+    for (*start = operator + strlen(strncmp(operator, HERESTRING, strlen(HERESTRING)) == 0 ? HERESTRING : HEREDOC); **start == ' ' || **start == '\t'; (*start)++)
+        ;
+
+    for (*end = *start; **end != '\0' && !isspace(**end) && strchr("<>|&", **end) == NULL; (*end)++)
+        ;
+
+    return operator;
+}
+
+/**
+ * Store the body of a here-document or here-string in a file descriptor that
+ * can be read as standard input, without using the file system.
+ *
+ * Small bodies are written to a pipe, which never blocks since they fit in its
+ * buffer. Larger ones are written to an anonymous memory file, which cannot
+ * fill up while the shell is still writing, unlike a pipe with no reader yet.
+ *
+ * @param body The characters of the body.
+ * @param length The number of characters of the body.
+ * @param pipeSize The capacity requested for pipes.
+ * @return A file descriptor, closed on `exec`, positioned at the start of the
+ * body, or `NO_INPUT` if the body could not be stored.
+ */
+int feed(const char *body, const int length, const int pipeSize)
+{
+    int p[PIPE];
+    int fd;
+
+    if (length <= PIPE_BUF)
+    {
+        if (!createPipe(p, pipeSize))
+        {
+            return NO_INPUT;
+        }
+
+        if (!transfer(p[PIPE_WRITE], body, length))
+        {
+            fprintf(stderr, "%s: Error. %s\n", HEREDOC, strerror(errno));
+
+            close(p[PIPE_READ]);
+            close(p[PIPE_WRITE]);
+            return NO_INPUT;
+        }
+
+        close(p[PIPE_WRITE]);
+
+        return p[PIPE_READ];
+    }
+
+    fd = memfd_create("heredoc", MFD_CLOEXEC);
+
+    if (fd == -1 || !transfer(fd, body, length) || lseek(fd, 0, SEEK_SET) == -1)
+    {
+        fprintf(stderr, "%s: Error. %s\n", HEREDOC, strerror(errno));
+
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return NO_INPUT;
+    }
+
+    return fd;
+}
+
+/**
+ * Write a whole buffer to a file descriptor, resuming short and interrupted
+ * writes.
+ *
+ * @param fd The file descriptor.
+ * @param data The characters to be written.
+ * @param length The number of characters to be written.
+ * @return 1 if every character was written, 0 otherwise, with `errno` set.
+ */
+int transfer(const int fd, const char *data, const int length)
+{
+    int written, bytes;
+
+    for (written = 0; written < length; written += bytes)
+    {
+        bytes = write(fd, &data[written], length - written);
+
+        if (bytes == -1 && errno == EINTR)
+        {
+            bytes = 0;
+        }
+        else if (bytes <= 0)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Expand the variables `$NAME` and `${NAME}`, the exit status `$?` and the
+ * command substitutions `$(...)` of a command line in a single pass.
+ *
+ * Expansions are processed from left to right. Undefined variables expand to
+ * an empty string. Substitutions may be nested, in which case the innermost
+ * ones are expanded first as part of the enclosing command.
+ *
+ * @param buffer The command line to be expanded.
+ * @param shell A pointer to the structure representing the shell state.
+ * @return The expanded command line, which must be freed, or NULL if it could
+ * not be expanded.
+ */
+char *expand(const char buffer[], tshell *shell)
+{
+    int index, length, capacity, depth, end, written, braces;
+    char *expanded;
+    char *command;
+    char *value;
+
+    length = 0;
+    capacity = EXPANSION_BUFFER_SIZE;
+    expanded = malloc(capacity);
+
+    for (index = 0; buffer[index] != '\0'; index++)
+    {
+        if (buffer[index] == '$' && buffer[index + 1] == '(')
+        {
+            depth = 1;
+
+            for (end = index + 2; buffer[end] != '\0' && depth > 0; end++)
+            {
+                if (buffer[end] == '(')
+                {
+                    depth++;
+                }
+                else if (buffer[end] == ')')
+                {
+                    depth--;
+                }
+            }
+
+            if (depth > 0)
+            {
+                fprintf(stderr, "$(: Error. Unterminated command substitution\n");
+                free(expanded);
+                return NULL;
+            }
+
+            // Skip `$(` and the closing `)` of the substitution
+            command = strndup(&buffer[index + 2], end - index - 3);
+            written = substitute(command, &expanded, &length, &capacity, shell);
+            free(command);
+
+            if (!written)
+            {
+                free(expanded);
+                return NULL;
+            }
+
+            index = end - 1;
+        }
+        else if (buffer[index] == '$' && (buffer[index + 1] == '{' || buffer[index + 1] == *STATUS || variable(buffer[index + 1], 1)))
+        {
+            braces = buffer[index + 1] == '{';
+
+            for (end = index + 1 + braces; variable(buffer[end], end == index + 1 + braces); end++)
+                ;
+
+            // The exit status is the only variable whose name is not an identifier
+            if (end == index + 1 + braces && buffer[end] == *STATUS)
+            {
+                end++;
+            }
+
+            if (braces && buffer[end] != '}')
+            {
+                fprintf(stderr, "${: Error. Bad substitution\n");
+                free(expanded);
+                return NULL;
+            }
+
+            value = lookup(&shell->variables, &buffer[index + 1 + braces], end - index - 1 - braces);
+            written = value == NULL ? 0 : strlen(value);
+
+            reserve(&expanded, &capacity, length + written + 1);
+            memcpy(&expanded[length], value, written);
+
+            length += written;
+            index = end - 1 + braces;
+        }
+        else
+        {
+            reserve(&expanded, &capacity, length + 2);
+            expanded[length++] = buffer[index];
+        }
+    }
+
+    expanded[length] = '\0';
+
+    return expanded;
+}
+
+/**
+ * Make sure a buffer can hold a number of characters, doubling its capacity
+ * as many times as needed.
+ *
+ * @param buffer Pointer to the buffer, which may be moved.
+ * @param capacity Pointer to the capacity of the buffer.
+ * @param needed The number of characters the buffer must hold.
+ */
+void reserve(char **buffer, int *capacity, const int needed)
+{
+    if (needed <= *capacity)
+    {
+        return;
+    }
+
+    while (needed > *capacity)
+    {
+        *capacity *= 2;
+    }
+
+    *buffer = realloc(*buffer, *capacity);
+}
+
+/**
+ * Check if a character can be part of a variable name.
+ *
+ * @param character The character to be checked.
+ * @param first 1 if the character starts the name, 0 otherwise.
+ * @return 1 if the character is a letter, an underscore or, when it does not
+ * start the name, a digit. 0 otherwise.
+ */
+int variable(const char character, const int first)
+{
+    return isalpha(character) || character == '_' || (!first && isdigit(character));
+}
+
+/**
+ * Run a command line and append its standard output to the given buffer.
+ *
+ * The command line is interpreted by a child shell whose standard output is a
+ * pipe, so it may hold compound commands. The parent reads the pipe while the
+ * command is still running, in large reads straight into the destination
+ * buffer, which grows as needed, so producers never block on a full pipe and
+ * the output is not copied again. Newlines are then replaced by spaces, except
+ * the trailing ones, which are removed. The exit status of the command line
+ * becomes the one of the last command and of the substitution.
+ *
+ * @param command The command line whose output is substituted.
+ * @param output Pointer to the buffer where the output of the command line is
+ * appended, which may be moved.
+ * @param length Pointer to the number of characters of the buffer.
+ * @param capacity Pointer to the capacity of the buffer.
+ * @param shell A pointer to the structure representing the shell state.
+ * @return 1 if the output was appended, 0 otherwise.
+ */
+int substitute(const char *command, char **output, int *length, int *capacity, tshell *shell)
+{
+    int p[PIPE];
+    pid_t pid;
+    int start, bytes, index, status;
+    tsource source;
+
+    if (strlen(command) >= MAXIMUM_LINE_LENGTH)
+    {
+        fprintf(stderr, "$(: Error. Command line too long\n");
+        return 0;
+    }
+
+    if (!createPipe(p, shell->pipeSize))
+    {
+        return 0;
+    }
+
+    // Pending output would otherwise be flushed again by the child
+    fflush(stdout);
+
+    pid = fork();
+
+    if (pid == -1)
+    {
+        fprintf(stderr, "$(: Error. %s\n", strerror(errno));
+
+        close(p[PIPE_READ]);
+        close(p[PIPE_WRITE]);
+        return 0;
+    }
+
+    if (pid == FORK_CHILD)
+    {
+        close(p[PIPE_READ]);
+
+        dup2(p[PIPE_WRITE], STDOUT_FILENO);
+        close(p[PIPE_WRITE]);
+
+        // Output of the jobs and metrics requests are left to the parent
+        abandon(&shell->jobs);
+
+        // Compound commands cannot read further lines of the shell input
+        shell->input.start = 0;
+        shell->input.end = 0;
+        shell->input.closed = 1;
+
+        strcpy(source.line, command);
+        source.position = source.line;
+        source.pending[0] = '\0';
+        source.shell = shell;
+
+        interpret(&source, shell);
+
+        // Leave the offset of a shared standard input untouched
+        fflush(stdout);
+        _exit(atoi(lookup(&shell->variables, STATUS, strlen(STATUS))));
+    }
+
+    close(p[PIPE_WRITE]);
+
+    start = *length;
+
+    do
+    {
+        reserve(output, capacity, *length + BUFSIZ + 1);
+        bytes = read(p[PIPE_READ], &(*output)[*length], *capacity - *length - 1);
+
+        if (bytes > 0)
+        {
+            *length += bytes;
+        }
+    } while (bytes > 0 || (bytes == -1 && errno == EINTR));
+
+    close(p[PIPE_READ]);
+
+    status = EXIT_SUCCESS;
+
+    while (waitpid(pid, &status, WAIT) == -1 && errno == EINTR)
+        ;
+
+    shell->substitution = exitStatus(status);
+    remember(shell->substitution, shell);
+
+    while (*length > start && (*output)[*length - 1] == '\n')
+    {
+        (*length)--;
+    }
+
+    for (index = start; index < *length; index++)
+    {
+        if ((*output)[index] == '\n')
+        {
+            (*output)[index] = ' ';
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Store the standard input, output, and error file descriptors for later
+ * restoration.
+ *
+ * @param stdinfd Pointer to the variable to store the original standard input
+ * file descriptor.
+ * @param stdoutfd Pointer to the variable to store the original standard
+ * output file descriptor.
+ * @param stderrfd Pointer to the variable to store the original standard error
+ * file descriptor.
+ */
+void store(int *stdinfd, int *stdoutfd, int *stderrfd)
+{
+    // Copies are closed on `exec` so executed commands do not inherit them
+    *stderrfd = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+    *stdinfd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+    *stdoutfd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+}
+
+/**
+ * Redirect standard input, output, and error based on the information provided
+ * in the given command line structure.
+ *
+ * @param line A pointer to a `tline` structure representing the command line.
+ * @param input File descriptor of the here-document or here-string of the
+ * command line, or `NO_INPUT` if there is none.
+ * @param output File descriptor capturing the standard output and error of a
+ * background job, or `NO_OUTPUT` if they are not captured. Redirections to
+ * files take precedence over it.
+ * @param stdinfd Pointer to the variable to store the original standard input
+ * file descriptor.
+ * @param stdoutfd Pointer to the variable to store the original standard
+ * output file descriptor.
+ * @param stderrfd Pointer to the variable to store the original standard error
+ * file descriptor.
+ */
+void redirect(const tline *line, const int input, const int output)
+{
+    if (output != NO_OUTPUT)
+    {
+        dup2(output, STDOUT_FILENO);
+        dup2(output, STDERR_FILENO);
+    }
+
+    if (line->redirect_error != NULL)
+    {
+        auxiliarRedirect(line->redirect_error, FILE_WRITE, STDERR_FILENO);
+    }
+
+    if (line->redirect_input != NULL)
+    {
+        auxiliarRedirect(line->redirect_input, FILE_READ, STDIN_FILENO);
+    }
+
+    if (input != NO_INPUT)
+    {
+        dup2(input, STDIN_FILENO);
+    }
+
+    if (line->redirect_output != NULL)
+    {
+        auxiliarRedirect(line->redirect_output, FILE_WRITE, STDOUT_FILENO);
+    }
+}
+
+/**
+ * Auxiliary function for redirecting a specific file descriptor based on the
+ * given filename and mode.
+ *
+ * @param filename The name of the file to be used for redirection.
+ * @param MODE The mode to be used in `fopen()` for opening the file (e.g.,
+ * `FILE_READ`, `FILE_WRITE`).
+ * @param STD_FILENO The standard file descriptor to be redirected (e.g.,
+ * `STDIN_FILENO`, `STDOUT_FILENO`).
+ */
+void auxiliarRedirect(char *filename, const char *MODE, const int STD_FILENO)
+{
+    FILE *file;
+    int fd;
+
+    file = fopen(filename, MODE);
+    if (file == NULL)
+    {
+        fprintf(stderr, "%s: Error. %s\n", filename, strerror(errno));
+    }
+
+    fd = fileno(file);
+
+    dup2(fd, STD_FILENO);
+
+    fclose(file);
+    close(fd);
+}
+
+/**
+ * Run a command specified by the given command line structure.
+ *
+ * @param line A pointer to a `tline` structure representing the command line.
+ * @param number The index of the command to be ran within the command line.
+ * @param environment The environment of the command, built from the exported
+ * variables.
+ *
+ * The executable path resolved by the parser is used, so `PATH` is not
+ * searched again. If the command execution fails, an error message is printed
+ * to `stderr` indicating that was not found, and the program exits with a
+ * failure status.
+ */
+void run(const tline *line, const int number, char *const environment[])
+{
+    char **arguments;
+    char *command;
+    sigset_t children;
+
+    arguments = line->commands[number].argv;
+    command = arguments[COMMAND];
+
+    // The signal mask survives `exec`, and commands expect `SIGCHLD`
+    sigemptyset(&children);
+    sigaddset(&children, SIGCHLD);
+    sigprocmask(SIG_UNBLOCK, &children, NULL);
+
+    if (line->commands[number].filename != NULL)
+    {
+        execve(line->commands[number].filename, arguments, environment);
+    }
+
+    execvpe(command, arguments, environment);
+
+    fprintf(stderr, "%s: Command not found\n", command);
+
+    // Leave the offset of a shared standard input untouched
+    _exit(EXIT_FAILURE);
+}
+
+/**
+ * Restore the original standard input, output, and error file descriptors.
+ *
+ * @param stdinfd The original standard input file descriptor.
+ * @param stdoutfd The original standard output file descriptor.
+ * @param stderrfd The original standard error file descriptor.
+ */
+void restore(const int stdinfd, const int stdoutfd, const int stderrfd)
+{
+    dup2(stderrfd, STDERR_FILENO);
+    dup2(stdinfd, STDIN_FILENO);
+    dup2(stdoutfd, STDOUT_FILENO);
+}
+
+/**
+ * Execute a series of commands specified in the given command line structure.
+ *
+ * @param line A data structure representing a command line with multiple
+ * commands.
+ * @param shell A pointer to the structure representing the shell state, whose
+ * list of active jobs could be updated if the command line is executed in
+ * background.
+ * @param buffer A buffer where the command line instruction is stored.
+ * @param input File descriptor of the here-document or here-string of the
+ * command line, or `NO_INPUT` if there is none.
+ *
+ * Take a `tline` command line structure as input and starts all its commands
+ * managing the flow of input and output through pipes. In foreground, the
+ * commands are waited for once all of them are running, so every stage of a
+ * pipeline consumes its input while the previous ones produce it. Also
+ * updates the `jobs` data structure if the command line is executed in
+ * background.
+ *
+ * @return The exit status of the last command if the command line is executed
+ * in foreground, `EXIT_SUCCESS` otherwise.
+ *
+ * Note:
+ *   This function relies on the `parser.h` library and auxiliary functions
+ *   like `store`, `redirect`, `run`, `restore`, and assumes the existence of
+ *   constants like `PIPE_READ`, `PIPE_WRITE`, etc.
+ */
+int executeExternalCommands(const tline *line, tshell *shell, const char buffer[], const int input)
+{
+    int stdinfd, stdoutfd, stderrfd;
+    int commands, command;
+    int next, even, last, background;
+    pid_t pid;
+    pid_t pids[MAXIMUM_PID_LIST_SIZE];
+    int p[PIPE], p2[PIPE];
+    int output[PIPE];
+    tjob *currentJob;
+    tjobs *jobs;
+    tmetrics *metrics;
+    long start;
+    int pipeSize;
+    char **commandsEnvironment;
+    int status;
+
+    if (line->ncommands > MAXIMUM_PID_LIST_SIZE)
+    {
+        fprintf(stderr, "Error. A command line may have up to %i commands\n", MAXIMUM_PID_LIST_SIZE);
+        return EXIT_FAILURE;
+    }
+
+    if (line->background == 1 && shell->jobs.size == MAXIMUM_JOB_LIST_SIZE)
+    {
+        fprintf(stderr, "Error. There may be up to %i jobs\n", MAXIMUM_JOB_LIST_SIZE);
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, ctrlc2);
+
+    status = EXIT_SUCCESS;
+
+    jobs = &shell->jobs;
+    metrics = jobs->metrics;
+    pipeSize = shell->pipeSize;
+    commandsEnvironment = environment(&shell->variables);
+
+    store(&stdinfd, &stdoutfd, &stderrfd);
+
+    commands = line->ncommands;
+    next = commands > 1;
+    background = line->background == 1;
+
+    output[PIPE_READ] = NO_OUTPUT;
+    output[PIPE_WRITE] = NO_OUTPUT;
+
+    if (background && shell->jobOutput != JOB_OUTPUT_OFF)
+    {
+        // The largest pipe lets the job run while the shell is busy
+        createPipe(output, maximumPipeSize());
+        fcntl(output[PIPE_READ], F_SETFL, O_NONBLOCK);
+    }
+
+    if (next)
+    {
+        createPipe(p, pipeSize);
+    }
+
+    start = metrics != NULL ? timestamp() : 0;
+    pid = fork();
+
+    if (pid == FORK_CHILD)
+    {
+        redirect(line, input, output[PIPE_WRITE]);
+
+        if (next)
+        {
+            // Does not receive input from anyone
+            close(p[PIPE_READ]);
+
+            // Pipe `stdout` output for next command input
+            dup2(p[PIPE_WRITE], STDOUT_FILENO);
+            close(p[PIPE_WRITE]);
+        }
+
+        if (metrics != NULL)
+        {
+            observe(metrics->exec, &metrics->execSum, start);
+        }
+
+        run(line, 0, commandsEnvironment);
+    }
+    else
+    {
+        if (metrics != NULL)
+        {
+            observe(metrics->spawn, &metrics->spawnSum, start);
+        }
+
+        pids[0] = pid;
+
+        // Only reads from pipe to provide input for next command
+        if (next)
+        {
+            close(p[PIPE_WRITE]);
+        }
+
+        // Clears `stdout` and `stdin` in case there are following commands
+        restore(stdinfd, stdoutfd, stderrfd);
+
+        if (background)
+        {
+            currentJob = &jobs->list[jobs->size];
+
+            snprintf(currentJob->instruction, MAXIMUM_LINE_LENGTH, "%s", buffer);
+            currentJob->size = commands;
+            currentJob->pids[0] = pid;
+            currentJob->remaining = commands;
+            currentJob->status = EXIT_SUCCESS;
+            currentJob->finished = 0;
+            memset(currentJob->reaped, 0, sizeof(currentJob->reaped));
+
+            currentJob->mode = output[PIPE_READ] == NO_OUTPUT ? JOB_OUTPUT_OFF : shell->jobOutput;
+            currentJob->output = output[PIPE_READ];
+            currentJob->tail = currentJob->mode == JOB_OUTPUT_OFF ? NULL : malloc(JOB_OUTPUT_SIZE);
+            currentJob->start = 0;
+            currentJob->length = 0;
+            currentJob->line = currentJob->mode == JOB_OUTPUT_LINE ? malloc(MAXIMUM_LINE_LENGTH) : NULL;
+            currentJob->lineLength = 0;
+
+            jobs->size++;
+
+            if (!next)
+            {
+                printf("[%i] %i\n", jobs->size, pid);
+            }
+        }
+
+        for (command = 1; next && command < commands; command++)
+        {
+            even = command % 2 == 0;
+            last = command == commands - 1;
+
+            // Restore the child process writing pipe to prevent errors
+            if (even)
+            {
+                createPipe(p, pipeSize);
+            }
+            else
+            {
+                createPipe(p2, pipeSize);
+            }
+
+            start = metrics != NULL ? timestamp() : 0;
+            pid = fork();
+
+            if (pid == FORK_CHILD)
+            {
+                redirect(line, input, output[PIPE_WRITE]);
+
+                // Reads from one pipe and writes to another based on parity
+                if (even)
+                {
+                    dup2(p2[PIPE_READ], STDIN_FILENO);
+                    if (!last)
+                    {
+                        dup2(p[PIPE_WRITE], STDOUT_FILENO);
+                    }
+                }
+                else
+                {
+                    dup2(p[PIPE_READ], STDIN_FILENO);
+                    if (!last)
+                    {
+                        dup2(p2[PIPE_WRITE], STDOUT_FILENO);
+                    }
+                }
+                close(p[PIPE_READ]);
+                close(p[PIPE_WRITE]);
+                close(p2[PIPE_READ]);
+                close(p2[PIPE_WRITE]);
+
+                if (metrics != NULL)
+                {
+                    observe(metrics->exec, &metrics->execSum, start);
+                }
+
+                run(line, command, commandsEnvironment);
+            }
+            else
+            {
+                if (metrics != NULL)
+                {
+                    observe(metrics->spawn, &metrics->spawnSum, start);
+                }
+
+                pids[command] = pid;
+
+                if (even)
+                {
+                    dup2(STDIN_FILENO, p[PIPE_WRITE]);
+                    close(p[PIPE_WRITE]);
+
+                    // Closes unnecessary pipes for the next odd child
+                    close(p2[PIPE_READ]);
+                    if (last)
+                    {
+                        close(p[PIPE_READ]);
+                        close(p2[PIPE_WRITE]);
+                    }
+                }
+                else
+                {
+                    dup2(STDIN_FILENO, p2[PIPE_WRITE]);
+                    close(p2[PIPE_WRITE]);
+
+                    // Closes unnecessary pipes for the next even child
+                    close(p[PIPE_READ]);
+                    if (last)
+                    {
+                        close(p2[PIPE_READ]);
+                        close(p[PIPE_WRITE]);
+                    }
+                }
+
+                if (background)
+                {
+                    currentJob->pids[command] = pid;
+
+                    if (last)
+                    {
+                        printf("[%i] %i\n", jobs->size, pid);
+                    }
+                }
+            }
+        }
+
+        // Only the processes of the job write to the captured output
+        if (output[PIPE_WRITE] != NO_OUTPUT)
+        {
+            close(output[PIPE_WRITE]);
+        }
+        
+        // Finish by cleaning `stdout` and `stdin` again for next iteration
+        restore(stdinfd, stdoutfd, stderrfd);
+
+        close(stdinfd);
+        close(stdoutfd);
+        close(stderrfd);
+
+        // The exit status of a pipeline is the one of its last command
+        for (command = 0; !background && command < commands; command++)
+        {
+            while (collect(jobs, pids[command], &status) == -1 && errno == EINTR);
+        }
+    }
+
+    signal(SIGINT, ctrlc);
+
+    return exitStatus(status);
+}
+
+/**
+ * Map the status reported by `waitpid` to the exit status of a command.
+ *
+ * @param status The status reported by `waitpid`.
+ * @return The exit code of the command, or `SIGNAL_STATUS` plus the signal
+ * number if it was terminated by a signal.
+ */
+int exitStatus(const int status)
+{
+    if (WIFSIGNALED(status))
+    {
+        return SIGNAL_STATUS + WTERMSIG(status);
+    }
+
+    return WEXITSTATUS(status);
+}
+
+/**
+ * Create a pipe whose ends are closed on `exec` and, if requested, resize it.
+ *
+ * Stages of a pipeline only keep the ends they `dup2` onto their standard
+ * streams, so no stray pipe end survives into the executed programs. When a
+ * larger capacity is requested, producers can write bulk data without being
+ * put to sleep every 64 KiB waiting for the consumer.
+ *
+ * @param p Array where the read and write ends of the pipe are stored.
+ * @param size The capacity requested for the pipe in bytes, or
+ * `DEFAULT_PIPE_SIZE` to keep the kernel default.
+ * @return 1 if the pipe was created, 0 otherwise.
+ */
+int createPipe(int p[PIPE], const int size)
+{
+    if (pipe2(p, O_CLOEXEC) == -1)
+    {
+        fprintf(stderr, "pipe: Error. %s\n", strerror(errno));
+        return 0;
+    }
+
+    // The kernel rounds the size up to a power of two number of pages
+    if (size != DEFAULT_PIPE_SIZE && fcntl(p[PIPE_WRITE], F_SETPIPE_SZ, size) == -1)
+    {
+        fprintf(stderr, "pipesize: Error. %s\n", strerror(errno));
+    }
+
+    return 1;
+}
+
+/**
+ * Changes the current working directory.
+ *
+ * Changes the current working directory to the specified directory. If no
+ * directory is provided (NULL), it changes to the HOME directory.
+ *
+ * @param directory The path of the target directory. If NULL, changes to the
+ * HOME directory.
+ * @param variables A pointer to the variable store where HOME is looked up.
+ */
+void mshcd(const char *directory, tvariables *variables)
+{
+    char *home;
+
+    if (directory == NULL)
+    {
+        home = lookup(variables, HOME, strlen(HOME));
+
+        if (home != NULL)
+        {
+            chdir(home);
+        }
+    }
+    else
+    {
+        chdir(directory);
+    }
+}
+
+/**
+ * Set the umask value based on the provided mask and update the formatted mask.
+ *
+ * @param mask The octal string representing the new umask value.
+ * @param formattedMask Pointer to the variable to store the formatted mask.
+ */
+void mshumask(const char *mask, int *formattedMask)
+{
+    int mappedMask;
+
+    if (mask == NULL)
+    {
+        printMask(*formattedMask);
+        return;
+    }
+
+    if (!octal(mask))
+    {
+        fprintf(stderr, "%s: Error. Invalid argument\n", mask);
+        return;
+    }
+
+    sscanf(mask, "%o", &mappedMask);
+    umask(mappedMask);
+
+    *formattedMask = atoi(mask);
+    printMask(*formattedMask);
+}
+
+/**
+ * Prints the octal representation of a file permissions mask.
+ *
+ * This function takes an integer `mask` representing a file permissions mask
+ * and prints its octal representation. It ensures that the printed octal
+ * number always consists of at least four digits by padding with leading zeros
+ * if needed.
+ *
+ * @param mask An integer representing the file permissions mask.
+ *
+ * Example:
+ *   printMask(644);  // Output: 0644
+ *   printMask(7);    // Output: 0007
+ */
+void printMask(const int mask)
+{
+    int auxiliarMask;
+    int zeros;
+    int _;
+
+    auxiliarMask = mask;
+    zeros = 4;
+
+    // Calculate the number of leading zeros needed
+    while (auxiliarMask > 0)
+    {
+        auxiliarMask = auxiliarMask / 10;
+        zeros--;
+    }
+
+    // Print leading zeros
+    for (_ = 0; _ < zeros; _++)
+    {
+        printf("0");
+    }
+
+    printf("%i\n", mask);
+}
+
+/**
+ * Check if a given string represents a valid octal number.
+ *
+ * Ensure that the string is not NULL, has a length of at most 4 characters,
+ * and each character represents a valid octal digit (0-7).
+ *
+ * @param number The string to be checked for octal validity.
+ * @return 1 if the string is a valid octal number, 0 otherwise.
+ */
+int octal(const char *number)
+{
+    int length;
+    int index;
+    int mappedDigit;
+
+    if (number == NULL)
+    {
+        return 0;
+    }
+
+    length = strlen(number);
+
+    if (length > 4)
+    {
+        return 0;
+    }
+
+    for (index = 0; index < length; index++)
+    {
+        mappedDigit = number[index] - 48;
+
+        if (mappedDigit < 0 || mappedDigit > 7)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Set the capacity of the pipes created for pipelines or display it.
+ *
+ * The size may be a number of bytes or `PIPE_MAXIMUM_SIZE` to use the largest
+ * capacity allowed by the kernel. Sizes above that limit are clamped to it and
+ * a size of 0 restores the kernel default.
+ *
+ * @param size The string representing the new pipe capacity. If NULL, the
+ * current capacity is displayed.
+ * @param pipeSize Pointer to the variable storing the pipe capacity.
+ */
+void mshpipesize(const char *size, int *pipeSize)
+{
+    int maximumSize;
+    long mappedSize;
+    char *end;
+
+    if (size == NULL)
+    {
+        if (*pipeSize == DEFAULT_PIPE_SIZE)
+        {
+            printf("default\n");
+        }
+        else
+        {
+            printf("%i\n", *pipeSize);
+        }
+        return;
+    }
+
+    maximumSize = maximumPipeSize();
+
+    if (strcmp(size, PIPE_MAXIMUM_SIZE) == 0)
+    {
+        mappedSize = maximumSize;
+    }
+    else
+    {
+        errno = 0;
+        mappedSize = strtol(size, &end, 10);
+
+        if (end == size || *end != '\0' || errno == ERANGE || mappedSize < 0 || mappedSize > INT_MAX)
+        {
+            fprintf(stderr, "%s: Error. Invalid argument\n", size);
+            return;
+        }
+    }
+
+    if (maximumSize != DEFAULT_PIPE_SIZE && mappedSize > maximumSize)
+    {
+        mappedSize = maximumSize;
+    }
+
+    *pipeSize = mappedSize;
+}
+
+/**
+ * Read the largest pipe capacity an unprivileged process may request.
+ *
+ * @return The value of `PIPE_MAXIMUM_SIZE_FILE`, or `DEFAULT_PIPE_SIZE` if it
+ * cannot be read.
+ */
+int maximumPipeSize()
+{
+    FILE *file;
+    int size;
+
+    file = fopen(PIPE_MAXIMUM_SIZE_FILE, FILE_READ);
+    if (file == NULL)
+    {
+        return DEFAULT_PIPE_SIZE;
+    }
+
+    if (fscanf(file, "%i", &size) != 1)
+    {
+        size = DEFAULT_PIPE_SIZE;
+    }
+
+    fclose(file);
+
+    return size;
+}
+
+/**
+ * Mark variables as exported, optionally assigning them, or display the
+ * exported variables.
+ *
+ * A variable exported without a value that has none yet stays out of the
+ * environment until it is assigned.
+ *
+ * @param arguments NULL terminated array of `NAME` or `NAME=VALUE` arguments.
+ * If empty, the exported variables are displayed.
+ * @param variables A pointer to the variable store.
+ */
+void mshexport(char *arguments[], tvariables *variables)
+{
+    int index;
+    char *separator;
+    char *value;
+    tvariable *current;
+
+    if (arguments[0] == NULL)
+    {
+        for (index = 0; index < variables->capacity; index++)
+        {
+            current = &variables->list[index];
+
+            if (current->name != NULL && current->exported && current->value == NULL)
+            {
+                printf("%s\n", current->name);
+            }
+            else if (current->name != NULL && current->exported)
+            {
+                printf("%s=%s\n", current->name, current->value);
+            }
+        }
+        return;
+    }
+
+    for (index = 0; arguments[index] != NULL; index++)
+    {
+        separator = strchr(arguments[index], ASSIGNMENT);
+
+        if (separator == NULL && identifier(arguments[index], strlen(arguments[index])))
+        {
+            value = lookup(variables, arguments[index], strlen(arguments[index]));
+
+            if (value != NULL)
+            {
+                assign(variables, arguments[index], strlen(arguments[index]), value, 1);
+            }
+            else
+            {
+                declare(variables, arguments[index], strlen(arguments[index]));
+            }
+        }
+        else if (separator != NULL && assignment(arguments[index]))
+        {
+            assign(variables, arguments[index], separator - arguments[index], separator + 1, 1);
+        }
+        else
+        {
+            fprintf(stderr, "export: %s: Error. Not a valid identifier\n", arguments[index]);
+        }
+    }
+}
+
+/**
+ * Remove variables from the variable store.
+ *
+ * @param arguments NULL terminated array of variable names.
+ * @param variables A pointer to the variable store.
+ */
+void mshunset(char *arguments[], tvariables *variables)
+{
+    int index;
+
+    for (index = 0; arguments[index] != NULL; index++)
+    {
+        discard(variables, arguments[index]);
+    }
+}
+
+/**
+ * Assign shell variables from a command made only of `NAME=VALUE` words.
+ *
+ * Variables that were already exported remain exported.
+ *
+ * @param arguments NULL terminated array of `NAME=VALUE` arguments.
+ * @param variables A pointer to the variable store.
+ */
+void mshassign(char *arguments[], tvariables *variables)
+{
+    int index;
+    char *separator;
+
+    for (index = 0; arguments[index] != NULL; index++)
+    {
+        if (!assignment(arguments[index]))
+        {
+            fprintf(stderr, "%s: Command not found\n", arguments[index]);
+            return;
+        }
+
+        separator = strchr(arguments[index], ASSIGNMENT);
+        assign(variables, arguments[index], separator - arguments[index], separator + 1, 0);
+    }
+}
+
+/**
+ * Check if an argument is a variable assignment.
+ *
+ * @param argument The argument to be checked.
+ * @return 1 if the argument has the form `NAME=VALUE` with a valid variable
+ * name, 0 otherwise.
+ */
+int assignment(const char *argument)
+{
+    char *separator;
+
+    separator = strchr(argument, ASSIGNMENT);
+
+    return separator != NULL && identifier(argument, separator - argument);
+}
+
+/**
+ * Check if a string is a valid variable name.
+ *
+ * @param name The string to be checked.
+ * @param length The number of characters of the string.
+ * @return 1 if the string is a letter or an underscore followed by letters,
+ * digits or underscores, 0 otherwise.
+ */
+int identifier(const char *name, const int length)
+{
+    int index;
+
+    for (index = 0; index < length; index++)
+    {
+        if (!variable(name[index], index == 0))
+        {
+            return 0;
+        }
+    }
+
+    return length > 0;
+}
+
+/**
+ * Create the variable store and fill it with the environment of the shell,
+ * whose variables are all exported.
+ *
+ * @param variables A pointer to the variable store to be initialized.
+ */
+void initialize(tvariables *variables)
+{
+    int index;
+    char *separator;
+
+    variables->capacity = VARIABLE_STORE_CAPACITY;
+    variables->size = 0;
+    variables->list = calloc(variables->capacity, sizeof(tvariable));
+    variables->environment = NULL;
+    variables->outdated = 1;
+
+    for (index = 0; environ[index] != NULL; index++)
+    {
+        separator = strchr(environ[index], ASSIGNMENT);
+
+        if (separator != NULL)
+        {
+            assign(variables, environ[index], separator - environ[index], separator + 1, 1);
+        }
+    }
+}
+
+/**
+ * Compute the FNV-1a hash of a string.
+ *
+ * @param string The characters to be hashed.
+ * @param length The number of characters to be hashed.
+ * @return The hash of the first `length` characters of `string`.
+ */
+unsigned long hash(const char *string, const int length)
+{
+    unsigned long value;
+    int index;
+
+    value = 14695981039346656037UL;
+
+    for (index = 0; index < length; index++)
+    {
+        value = (value ^ (unsigned char)string[index]) * 1099511628211UL;
+    }
+
+    return value;
+}
+
+/**
+ * Find the slot of a variable in the variable store.
+ *
+ * @param variables A pointer to the variable store.
+ * @param name The characters of the variable name, not necessarily NULL
+ * terminated.
+ * @param length The length of the variable name.
+ * @return The slot holding the variable or, if it is not stored, the empty
+ * slot where it would be stored.
+ */
+int locate(const tvariables *variables, const char *name, const int length)
+{
+    int mask, index;
+    tvariable *current;
+
+    mask = variables->capacity - 1;
+
+    for (index = hash(name, length) & mask;; index = (index + 1) & mask)
+    {
+        current = &variables->list[index];
+
+        if (current->name == NULL || (strncmp(current->name, name, length) == 0 && current->name[length] == '\0'))
+        {
+            return index;
+        }
+    }
+}
+
+/**
+ * Get the value of a variable.
+ *
+ * @param variables A pointer to the variable store.
+ * @param name The characters of the variable name, not necessarily NULL
+ * terminated.
+ * @param length The length of the variable name.
+ * @return The value of the variable, or NULL if it is not defined.
+ */
+char *lookup(const tvariables *variables, const char *name, const int length)
+{
+    tvariable *current;
+
+    current = &variables->list[locate(variables, name, length)];
+
+    return current->name == NULL ? NULL : current->value;
+}
+
+/**
+ * Define a variable or change its value.
+ *
+ * @param variables A pointer to the variable store.
+ * @param name The characters of the variable name, not necessarily NULL
+ * terminated.
+ * @param length The length of the variable name.
+ * @param value The new value of the variable.
+ * @param exported 1 to export the variable, 0 to keep its current state.
+ */
+void assign(tvariables *variables, const char *name, const int length, const char *value, const int exported)
+{
+    tvariable *current;
+    char *copy;
+
+    current = &variables->list[locate(variables, name, length)];
+
+    // The value may belong to the variable being replaced
+    copy = strdup(value);
+
+    if (current->name == NULL)
+    {
+        current->name = strndup(name, length);
+        current->exported = 0;
+        variables->size++;
+    }
+    else
+    {
+        free(current->value);
+    }
+
+    current->value = copy;
+    current->exported = current->exported || exported;
+    variables->outdated = variables->outdated || current->exported;
+
+    // Keep the load factor under one half so probe sequences stay short
+    if (variables->size * 2 > variables->capacity)
+    {
+        grow(variables);
+    }
+}
+
+/**
+ * Mark a variable without a value as exported, so it is passed to the
+ * environment of executed commands once it is assigned.
+ *
+ * @param variables A pointer to the variable store.
+ * @param name The characters of the variable name, not necessarily NULL
+ * terminated.
+ * @param length The length of the variable name.
+ */
+void declare(tvariables *variables, const char *name, const int length)
+{
+    tvariable *current;
+
+    current = &variables->list[locate(variables, name, length)];
+
+    if (current->name == NULL)
+    {
+        current->name = strndup(name, length);
+        current->value = NULL;
+        variables->size++;
+    }
+
+    current->exported = 1;
+
+    // Keep the load factor under one half so probe sequences stay short
+    if (variables->size * 2 > variables->capacity)
+    {
+        grow(variables);
+    }
+}
+
+/**
+ * Remove a variable from the variable store.
+ *
+ * Following variables of the same probe sequence are moved back so that no
+ * empty slot breaks the sequence.
+ *
+ * @param variables A pointer to the variable store.
+ * @param name The name of the variable.
+ */
+void discard(tvariables *variables, const char *name)
+{
+    int mask, empty, index, home;
+    tvariable *current;
+
+    mask = variables->capacity - 1;
+    empty = locate(variables, name, strlen(name));
+    current = &variables->list[empty];
+
+    if (current->name == NULL)
+    {
+        return;
+    }
+
+    variables->outdated = variables->outdated || current->exported;
+    variables->size--;
+
+    free(current->name);
+    free(current->value);
+    current->name = NULL;
+
+    for (index = (empty + 1) & mask; variables->list[index].name != NULL; index = (index + 1) & mask)
+    {
+        current = &variables->list[index];
+        home = hash(current->name, strlen(current->name)) & mask;
+
+        // Move the variable unless its home slot lies after the empty slot
+        if (((index - home) & mask) >= ((index - empty) & mask))
+        {
+            variables->list[empty] = *current;
+            current->name = NULL;
+            empty = index;
+        }
+    }
+}
+
+/**
+ * Double the capacity of the variable store, moving every variable to its
+ * slot in the new table.
+ *
+ * @param variables A pointer to the variable store.
+ */
+void grow(tvariables *variables)
+{
+    tvariable *list;
+    int capacity, index;
+
+    list = variables->list;
+    capacity = variables->capacity;
+
+    variables->capacity = capacity * 2;
+    variables->list = calloc(variables->capacity, sizeof(tvariable));
+
+    for (index = 0; index < capacity; index++)
+    {
+        if (list[index].name != NULL)
+        {
+            variables->list[locate(variables, list[index].name, strlen(list[index].name))] = list[index];
+        }
+    }
+
+    free(list);
+}
+
+/**
+ * Get the environment of executed commands.
+ *
+ * The `envp` array is cached and only rebuilt when an exported variable has
+ * changed. It also becomes `environ`, so lookups made through `getenv`, like
+ * the resolution of commands in `PATH`, see the exported variables.
+ *
+ * @param variables A pointer to the variable store.
+ * @return NULL terminated array of `NAME=VALUE` strings.
+ */
+char **environment(tvariables *variables)
+{
+    char **previous;
+    int index, size;
+    tvariable *current;
+
+    if (!variables->outdated)
+    {
+        return variables->environment;
+    }
+
+    previous = variables->environment;
+    variables->environment = malloc(sizeof(char *) * (variables->size + 1));
+    size = 0;
+
+    for (index = 0; index < variables->capacity; index++)
+    {
+        current = &variables->list[index];
+
+        if (current->name != NULL && current->exported && current->value != NULL)
+        {
+            variables->environment[size] = malloc(strlen(current->name) + strlen(current->value) + 2);
+            sprintf(variables->environment[size], "%s%c%s", current->name, ASSIGNMENT, current->value);
+            size++;
+        }
+    }
+
+    variables->environment[size] = NULL;
+    variables->outdated = 0;
+
+    environ = variables->environment;
+
+    for (index = 0; previous != NULL && previous[index] != NULL; index++)
+    {
+        free(previous[index]);
+    }
+    free(previous);
+
+    return variables->environment;
+}
+
+/**
+ * Terminate all running processes associated with active jobs and exit the
+ * shell.
+ *
+ * Iterates through the list of active jobs, terminates each process within the
+ * job, frees memory associated with the job list and exits the shell.
+ *
+ * @param jobs A pointer to the structure representing the list of active jobs.
+ */
+void mshexit(tjobs *jobs)
+{
+    int j, pid;
+    int jobsSize, jobSize;
+    tjob *job;
+
+    jobsSize = jobs->size;
+
+    for (j = 0; j < jobsSize; j++)
+    {
+        job = &jobs->list[j];
+        jobSize = job->size;
+
+        for (pid = 0; pid < jobSize; pid++)
+        {
+            // Reaped identifiers may already belong to other processes
+            if (!job->reaped[pid])
+            {
+                kill(job->pids[pid], KILL);
+            }
+        }
+    }
+
+    free(jobs->list);
+
+    mshmetrics(METRICS_OFF, jobs);
+
+    exit(EXIT_SUCCESS);
+}
+
+/**
+ * Display the status of jobs in the provided job list.
+ *
+ * Checks the status of each job in the list and prints whether it is done or
+ * running.
+ *
+ * If a job is done, it prints its completion status and saves it in
+ * `finishedJobs` local variable to remove it later.
+ *
+ * With `JOB_OUTPUT` and a job number, it displays the captured output of that
+ * job instead.
+ *
+ * @param arguments NULL terminated array of arguments.
+ * @param jobs A pointer to the structure representing the list of active jobs.
+ */
+void mshjobs(char *arguments[], tjobs *jobs)
+{
+    int j, jobsSize, formattedJ;
+    tjob *job;
+    int finishedJobs[MAXIMUM_JOB_LIST_SIZE];
+    int finishedJobsSize = 0;
+
+    if (arguments[0] != NULL && strcmp(arguments[0], JOB_OUTPUT) == 0)
+    {
+        j = arguments[1] == NULL ? 0 : atoi(&arguments[1][arguments[1][0] == JOB_PREFIX]) - 1;
+
+        if (j < 0 || j > jobs->size - 1)
+        {
+            fprintf(stderr, "jobs: Error. No such job\n");
+        }
+        else if (jobs->list[j].mode == JOB_OUTPUT_OFF)
+        {
+            fprintf(stderr, "jobs: Error. Output of job %i is not captured\n", j + 1);
+        }
+        else
+        {
+            drain(&jobs->list[j]);
+            printTail(&jobs->list[j]);
+        }
+        return;
+    }
+
+    jobsSize = jobs->size;
+
+    for (j = 0; j < jobsSize; j++)
+    {
+        job = &jobs->list[j];
+
+        formattedJ = j + 1;
+
+        if (finished(job, jobs->metrics))
+        {
+            printf("[%i] Done\t%s", formattedJ, job->instruction);
+
+            finishedJobs[finishedJobsSize] = j;
+            finishedJobsSize++;
+        }
+        else
+        {
+            printf("[%i] Running\t%s", formattedJ, job->instruction);
+        }
+    }
+
+    // Deleting a job moves the following ones, so the last ones go first
+    for (j = finishedJobsSize - 1; j >= 0; j--)
+    {
+        delete (finishedJobs[j], jobs);
+    }
+}
+
+/**
+ * Set how the output of new background jobs is written or display it.
+ *
+ * @param mode `off` to write it straight to the terminal, `line` to capture it
+ * and write it one whole line at a time, or `end` to capture it and write it
+ * once the job completes. If NULL, the current mode is displayed.
+ * @param jobOutput Pointer to the variable storing the mode.
  */
-void redirect(const tline *line)
+void mshjobbuffer(const char *mode, int *jobOutput)
 {
-    if (line->redirect_error != NULL)
+    static const char *modes[] = {"off", "line", "end"};
+
+    if (mode == NULL)
     {
-        auxiliarRedirect(line->redirect_error, FILE_WRITE, STDERR_FILENO);
+        printf("%s\n", modes[*jobOutput]);
     }
-
-    if (line->redirect_input != NULL)
+    else if (strcmp(mode, modes[JOB_OUTPUT_OFF]) == 0)
     {
-        auxiliarRedirect(line->redirect_input, FILE_READ, STDIN_FILENO);
+        *jobOutput = JOB_OUTPUT_OFF;
     }
-
-    if (line->redirect_output != NULL)
+    else if (strcmp(mode, modes[JOB_OUTPUT_LINE]) == 0)
     {
-        auxiliarRedirect(line->redirect_output, FILE_WRITE, STDOUT_FILENO);
+        *jobOutput = JOB_OUTPUT_LINE;
+    }
+    else if (strcmp(mode, modes[JOB_OUTPUT_END]) == 0)
+    {
+        *jobOutput = JOB_OUTPUT_END;
+    }
+    else
+    {
+        fprintf(stderr, "%s: Error. Invalid argument\n", mode);
     }
 }
 
 /**
- * Auxiliary function for redirecting a specific file descriptor based on the
- * given filename and mode.
+ * Store output captured from a job.
  *
- * @param filename The name of the file to be used for redirection.
- * @param MODE The mode to be used in `fopen()` for opening the file (e.g.,
- * `FILE_READ`, `FILE_WRITE`).
- * @param STD_FILENO The standard file descriptor to be redirected (e.g.,
- * `STDIN_FILENO`, `STDOUT_FILENO`).
+ * The output is kept in the ring buffer of the job, overwriting the oldest
+ * bytes once it is full. In `JOB_OUTPUT_LINE` mode, every completed line is
+ * also written to the terminal with a single `write`, after flushing the output
+ * of the shell, so lines of concurrent jobs are never interleaved.
+ *
+ * @param job The structure representing the job.
+ * @param data The bytes captured.
+ * @param size The number of bytes captured.
  */
-void auxiliarRedirect(char *filename, const char *MODE, const int STD_FILENO)
+void capture(tjob *job, const char *data, const int size)
 {
-    FILE *file;
-    int fd;
+    int index, position;
 
-    file = fopen(filename, MODE);
-    if (file == NULL)
+    for (index = 0; index < size; index++)
     {
-        fprintf(stderr, "%s: Error. %s\n", filename, strerror(errno));
-    }
+        position = (job->start + job->length) % JOB_OUTPUT_SIZE;
+        job->tail[position] = data[index];
 
-    fd = fileno(file);
+        if (job->length < JOB_OUTPUT_SIZE)
+        {
+            job->length++;
+        }
+        else
+        {
+            job->start = (job->start + 1) % JOB_OUTPUT_SIZE;
+        }
 
-    dup2(fd, STD_FILENO);
+        if (job->mode == JOB_OUTPUT_LINE)
+        {
+            job->line[job->lineLength++] = data[index];
 
-    fclose(file);
-    close(fd);
+            if (data[index] == '\n' || job->lineLength == MAXIMUM_LINE_LENGTH)
+            {
+                // Output of the shell still buffered by stdio goes first
+                fflush(stdout);
+                write(STDOUT_FILENO, job->line, job->lineLength);
+                job->lineLength = 0;
+            }
+        }
+    }
 }
 
 /**
- * Run a command specified by the given command line structure.
+ * Read the output available in the pipe capturing the output of a job,
+ * without blocking.
  *
- * @param line A pointer to a `tline` structure representing the command line.
- * @param number The index of the command to be ran within the command line.
+ * Once all the processes writing to the pipe have closed it, the pending
+ * output is written to the terminal and the pipe is closed.
  *
- * If the command execution fails, an error message is printed to `stderr`
- * indicating that was not found, and the program exits with a failure status.
+ * @param job The structure representing the job.
  */
-void run(const tline *line, const int number)
+void drain(tjob *job)
 {
-    char **arguments;
-    char *command;
+    char data[BUFSIZ];
+    int bytes;
 
-    arguments = line->commands[number].argv;
-    command = arguments[COMMAND];
+    if (job->output == NO_OUTPUT)
+    {
+        return;
+    }
 
-    execvp(command, arguments);
+    while ((bytes = read(job->output, data, BUFSIZ)) > 0)
+    {
+        capture(job, data, bytes);
+    }
 
-    fprintf(stderr, "%s: Command not found\n", command);
-    exit(EXIT_FAILURE);
+    if (bytes == 0)
+    {
+        flushOutput(job);
+
+        close(job->output);
+        job->output = NO_OUTPUT;
+    }
 }
 
 /**
- * Restore the original standard input, output, and error file descriptors.
+ * Write the output of a job that has not been written to the terminal yet:
+ * the last unfinished line in `JOB_OUTPUT_LINE` mode, or the whole captured
+ * output in `JOB_OUTPUT_END` mode.
  *
- * @param stdinfd The original standard input file descriptor.
- * @param stdoutfd The original standard output file descriptor.
- * @param stderrfd The original standard error file descriptor.
+ * @param job The structure representing the job.
  */
-void restore(const int stdinfd, const int stdoutfd, const int stderrfd)
+void flushOutput(tjob *job)
 {
-    dup2(stderrfd, STDERR_FILENO);
-    dup2(stdinfd, STDIN_FILENO);
-    dup2(stdoutfd, STDOUT_FILENO);
+    if (job->mode == JOB_OUTPUT_LINE && job->lineLength > 0)
+    {
+        fflush(stdout);
+        write(STDOUT_FILENO, job->line, job->lineLength);
+        job->lineLength = 0;
+    }
+    else if (job->mode == JOB_OUTPUT_END)
+    {
+        printTail(job);
+    }
 }
 
 /**
- * Execute a series of commands specified in the given command line structure.
- *
- * @param line A data structure representing a command line with multiple
- * commands.
- * @param jobs A pointer to the structure representing the list of active jobs
- * which could be updated if the command line is executed in background.
- * @param buffer A buffer where the command line instruction is stored.
- *
- * Take a `tline` command line structure as input and executes the commands
- * sequentially managing the flow of input and output through pipes. Also
- * updates the `jobs` data structure if the command line is executed in
- * background.
+ * Write the captured output of a job kept in its ring buffer with a single
+ * system call.
  *
- * Note:
- *   This function relies on the `parser.h` library and auxiliary functions
- *   like `store`, `redirect`, `run`, `restore`, and assumes the existence of
- *   constants like `PIPE_READ`, `PIPE_WRITE`, etc.
+ * @param job The structure representing the job.
  */
-void executeExternalCommands(const tline *line, tjobs *jobs, const char buffer[])
+void printTail(const tjob *job)
 {
-    int stdinfd, stdoutfd, stderrfd;
-    int commands, command;
-    int next, even, last, background;
-    pid_t pid;
-    int p[PIPE], p2[PIPE];
-    tjob *currentJob;
+    struct iovec parts[2];
+    int first;
 
-    signal(SIGINT, ctrlc2);
+    fflush(stdout);
 
-    store(&stdinfd, &stdoutfd, &stderrfd);
+    first = job->length < JOB_OUTPUT_SIZE - job->start ? job->length : JOB_OUTPUT_SIZE - job->start;
 
-    commands = line->ncommands;
-    next = commands > 1;
-    background = line->background == 1;
+    parts[0].iov_base = &job->tail[job->start];
+    parts[0].iov_len = first;
+    parts[1].iov_base = job->tail;
+    parts[1].iov_len = job->length - first;
 
-    if (next)
-    {
-        pipe(p);
-    }
+    writev(STDOUT_FILENO, parts, 2);
+}
 
-    pid = fork();
+/**
+ * Wait for a process like `waitpid` does, draining the captured output of the
+ * background jobs meanwhile so they never block on a full pipe, and serving
+ * metrics requests. The exit status of the process is counted in the metrics.
+ *
+ * When there is nothing else to watch, `waitpid` blocks. Otherwise the pipes
+ * and the socket are polled together with the `signalfd` of terminated
+ * children, so the shell sleeps until one of them is ready.
+ *
+ * @param jobs A pointer to the structure representing the list of active jobs.
+ * @param pid The process identifier, or -1 for any child process.
+ * @param status Pointer to the variable to store the status of the process.
+ * @return The process identifier of the process waited for, or -1 if there are
+ * no processes to wait for or the wait was interrupted by a signal.
+ */
+pid_t collect(tjobs *jobs, const pid_t pid, int *status)
+{
+    struct pollfd fds[MAXIMUM_JOB_LIST_SIZE + 2];
+    int owners[MAXIMUM_JOB_LIST_SIZE];
+    struct signalfd_siginfo information;
+    int count, index, listening;
+    pid_t collected;
 
-    if (pid == FORK_CHILD)
+    while (1)
     {
-        redirect(line);
-
-        if (next)
-        {
-            // Does not receive input from anyone
-            close(p[PIPE_READ]);
-
-            // Pipe `stdout` output for next command input
-            dup2(p[PIPE_WRITE], STDOUT_FILENO);
-            close(p[PIPE_WRITE]);
-        }
+        count = outputs(jobs, fds, owners);
 
-        run(line, 0);
-    }
-    else
-    {
-        // Only reads from pipe to provide input for next command
-        close(p[PIPE_WRITE]);
+        listening = jobs->listener != NO_LISTENER;
+        fds[count].fd = jobs->listener;
+        fds[count].events = POLLIN;
+        fds[count].revents = 0;
 
-        // Clears `stdout` and `stdin` in case there are following commands
-        restore(stdinfd, stdoutfd, stderrfd);
+        fds[count + listening].fd = jobs->children;
+        fds[count + listening].events = POLLIN;
+        fds[count + listening].revents = 0;
 
-        if (background)
+        if (count == 0 && !listening)
         {
-            currentJob = &jobs->list[jobs->size];
-
-            strcpy(currentJob->instruction, buffer);
-            currentJob->size = commands;
-            currentJob->pids[0] = pid;
-            currentJob->finished = 0;
-
-            jobs->size = (jobs->size + 1) % MAXIMUM_JOB_LIST_SIZE;
+            collected = waitpid(pid, status, WAIT);
+        }
+        else
+        {
+            collected = waitpid(pid, status, WNOHANG);
+        }
 
-            if (!next)
+        if (collected != 0)
+        {
+            if (collected > 0)
             {
-                printf("[%i] %i\n", jobs->size, pid);
+                tally(jobs->metrics, *status);
             }
+            return collected;
         }
-        else
+
+        if (poll(fds, count + listening + 1, -1) == -1 && errno == EINTR)
         {
-            wait(NULL);
+            return -1;
         }
 
-        for (command = 1; next && command < commands; command++)
+        // A child terminated after `waitpid`, which is tried again
+        while (read(jobs->children, &information, sizeof(information)) > 0)
+            ;
+
+        if (listening && fds[count].revents != 0)
         {
-            even = command % 2 == 0;
-            last = command == commands - 1;
+            serve(jobs);
+        }
 
-            // Restore the child process writing pipe to prevent errors
-            if (even)
-            {
-                pipe(p);
-            }
-            else
+        for (index = 0; index < count; index++)
+        {
+            if (fds[index].revents != 0)
             {
-                pipe(p2);
+                drain(&jobs->list[owners[index]]);
             }
+        }
+    }
+}
 
-            pid = fork();
-
-            if (pid == FORK_CHILD)
-            {
-                redirect(line);
+/**
+ * Start or stop serving metrics on a UNIX domain socket, or display where they
+ * are served.
+ *
+ * Every connection to the socket receives a report in the Prometheus text
+ * format and is closed. Counters are kept while metrics are not served.
+ *
+ * @param path The path of the socket, `METRICS_OFF` to stop serving metrics,
+ * or NULL to display the path.
+ * @param jobs A pointer to the structure representing the list of active jobs.
+ */
+void mshmetrics(const char *path, tjobs *jobs)
+{
+    struct sockaddr_un address;
+    struct stat file;
+    int listener;
 
-                // Reads from one pipe and writes to another based on parity
-                if (even)
-                {
-                    dup2(p2[PIPE_READ], STDIN_FILENO);
-                    if (!last)
-                    {
-                        dup2(p[PIPE_WRITE], STDOUT_FILENO);
-                    }
-                }
-                else
-                {
-                    dup2(p[PIPE_READ], STDIN_FILENO);
-                    if (!last)
-                    {
-                        dup2(p2[PIPE_WRITE], STDOUT_FILENO);
-                    }
-                }
-                close(p[PIPE_READ]);
-                close(p[PIPE_WRITE]);
-                close(p2[PIPE_READ]);
-                close(p2[PIPE_WRITE]);
+    if (path == NULL)
+    {
+        printf("%s\n", jobs->listener == NO_LISTENER ? METRICS_OFF : jobs->endpoint);
+        return;
+    }
 
-                run(line, command);
-            }
-            else
-            {
-                if (even)
-                {
-                    dup2(STDIN_FILENO, p[PIPE_WRITE]);
-                    close(p[PIPE_WRITE]);
+    if (jobs->listener != NO_LISTENER)
+    {
+        close(jobs->listener);
+        unlink(jobs->endpoint);
+        jobs->listener = NO_LISTENER;
+    }
 
-                    // Closes unnecessary pipes for the next odd child
-                    close(p2[PIPE_READ]);
-                    if (last)
-                    {
-                        close(p[PIPE_READ]);
-                        close(p2[PIPE_WRITE]);
-                    }
-                }
-                else
-                {
-                    dup2(STDIN_FILENO, p2[PIPE_WRITE]);
-                    close(p2[PIPE_WRITE]);
+    if (strcmp(path, METRICS_OFF) == 0)
+    {
+        return;
+    }
 
-                    // Closes unnecessary pipes for the next even child
-                    close(p[PIPE_READ]);
-                    if (last)
-                    {
-                        close(p2[PIPE_READ]);
-                        close(p[PIPE_WRITE]);
-                    }
-                }
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "%s: Error. Path too long\n", path);
+        return;
+    }
 
-                if (background)
-                {
-                    currentJob->pids[command] = pid;
+    if (jobs->metrics == NULL)
+    {
+        jobs->metrics = mmap(NULL, sizeof(tmetrics), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
 
-                    if (last)
-                    {
-                        printf("[%i] %i\n", jobs->size, pid);
-                    }
-                }
-                else
-                {
-                    wait(NULL);
-                }
-            }
+        if (jobs->metrics == MAP_FAILED)
+        {
+            fprintf(stderr, "metrics: Error. %s\n", strerror(errno));
+            jobs->metrics = NULL;
+            return;
         }
-        
-        // Finish by cleaning `stdout` and `stdin` again for next iteration
-        restore(stdinfd, stdoutfd, stderrfd);
     }
 
-    signal(SIGINT, ctrlc);
+    // Sockets left behind by a previous session are replaced
+    if (lstat(path, &file) == 0 && S_ISSOCK(file.st_mode))
+    {
+        unlink(path);
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (listener == -1 || bind(listener, (struct sockaddr *) &address, sizeof(address)) == -1 || listen(listener, SOMAXCONN) == -1)
+    {
+        fprintf(stderr, "%s: Error. %s\n", path, strerror(errno));
+
+        if (listener != -1)
+        {
+            close(listener);
+        }
+        return;
+    }
+
+    jobs->listener = listener;
+    strcpy(jobs->endpoint, path);
 }
 
 /**
- * Changes the current working directory.
+ * Release the jobs of the shell in a child process that keeps running shell
+ * code, like a command substitution, so it neither reads their output nor
+ * answers metrics requests, which are left to the parent.
  *
- * Changes the current working directory to the specified directory. If no
- * directory is provided (NULL), it changes to the HOME directory.
- *
- * @param directory The path of the target directory. If NULL, changes to the
- * HOME directory.
+ * @param jobs A pointer to the structure representing the list of active jobs.
  */
-void mshcd(const char *directory)
+void abandon(tjobs *jobs)
 {
-    if (directory == NULL)
+    int j;
+
+    for (j = 0; j < jobs->size; j++)
     {
-        chdir(getenv(HOME));
+        if (jobs->list[j].output != NO_OUTPUT)
+        {
+            close(jobs->list[j].output);
+        }
+
+        free(jobs->list[j].tail);
+        free(jobs->list[j].line);
     }
-    else
+
+    jobs->size = 0;
+
+    if (jobs->listener != NO_LISTENER)
     {
-        chdir(directory);
+        close(jobs->listener);
+        jobs->listener = NO_LISTENER;
     }
 }
 
 /**
- * Set the umask value based on the provided mask and update the formatted mask.
+ * Answer the pending connections to the metrics socket.
  *
- * @param mask The octal string representing the new umask value.
- * @param formattedMask Pointer to the variable to store the formatted mask.
+ * @param jobs A pointer to the structure representing the list of active jobs.
  */
-void mshumask(const char *mask, int *formattedMask)
+void serve(tjobs *jobs)
 {
-    int mappedMask;
+    char buffer[METRICS_REPORT_SIZE];
+    int connection, length;
 
-    if (mask == NULL)
+    while ((connection = accept4(jobs->listener, NULL, NULL, SOCK_CLOEXEC)) != -1)
     {
-        printMask(*formattedMask);
-        return;
+        length = report(jobs, buffer, METRICS_REPORT_SIZE);
+        write(connection, buffer, length);
+        close(connection);
     }
+}
 
-    if (!octal(mask))
+/**
+ * Write a metrics report in the Prometheus text format.
+ *
+ * @param jobs A pointer to the structure representing the list of active jobs.
+ * @param buffer Buffer where the report is written.
+ * @param size The capacity of the buffer.
+ * @return The length of the report.
+ */
+int report(tjobs *jobs, char buffer[], const int size)
+{
+    tmetrics *metrics;
+    unsigned long spawned, exits;
+    long pages, resident;
+    int length, index, descriptors, active;
+    DIR *directory;
+    FILE *statm;
+
+    metrics = jobs->metrics;
+    length = 0;
+
+    // Finished jobs stay in the list until they are reported
+    active = 0;
+    for (index = 0; index < jobs->size; index++)
     {
-        fprintf(stderr, "%s: Error. Invalid argument\n", mask);
-        return;
+        active += !jobs->list[index].finished;
     }
 
-    sscanf(mask, "%o", &mappedMask);
-    umask(mappedMask);
+    spawned = 0;
+    for (index = 0; index < LATENCY_BUCKETS; index++)
+    {
+        spawned += __atomic_load_n(&metrics->spawn[index], __ATOMIC_RELAXED);
+    }
 
-    *formattedMask = atoi(mask);
-    printMask(*formattedMask);
+    length += snprintf(&buffer[length], size - length,
+                       "# TYPE minishell_jobs_active gauge\n"
+                       "minishell_jobs_active %i\n"
+                       "# TYPE minishell_processes_spawned_total counter\n"
+                       "minishell_processes_spawned_total %lu\n",
+                       active, spawned);
+
+    length += histogram(&buffer[length], size - length, "minishell_spawn_latency_seconds", metrics->spawn, &metrics->spawnSum);
+    length += histogram(&buffer[length], size - length, "minishell_exec_latency_seconds", metrics->exec, &metrics->execSum);
+
+    length += snprintf(&buffer[length], size - length, "# TYPE minishell_exit_status_total counter\n");
+    for (index = 0; index < EXIT_STATUSES; index++)
+    {
+        exits = __atomic_load_n(&metrics->exits[index], __ATOMIC_RELAXED);
+
+        if (exits > 0)
+        {
+            length += snprintf(&buffer[length], size - length, "minishell_exit_status_total{status=\"%i\"} %lu\n", index, exits);
+        }
+    }
+
+    // The directory stream uses a descriptor itself
+    descriptors = -1;
+    directory = opendir("/proc/self/fd");
+    while (directory != NULL && readdir(directory) != NULL)
+    {
+        descriptors++;
+    }
+    if (directory != NULL)
+    {
+        closedir(directory);
+    }
+
+    // Besides the entries of the directory itself
+    descriptors -= 2;
+
+    resident = 0;
+    statm = fopen("/proc/self/statm", "r");
+    if (statm != NULL)
+    {
+        if (fscanf(statm, "%ld %ld", &pages, &resident) == 2)
+        {
+            resident *= sysconf(_SC_PAGESIZE);
+        }
+        fclose(statm);
+    }
+
+    length += snprintf(&buffer[length], size - length,
+                       "# TYPE minishell_open_fds gauge\n"
+                       "minishell_open_fds %i\n"
+                       "# TYPE minishell_resident_memory_bytes gauge\n"
+                       "minishell_resident_memory_bytes %ld\n",
+                       descriptors, resident);
+
+    return length < size ? length : size - 1;
 }
 
 /**
- * Prints the octal representation of a file permissions mask.
+ * Write a latency histogram in the Prometheus text format.
  *
- * This function takes an integer `mask` representing a file permissions mask
- * and prints its octal representation. It ensures that the printed octal
- * number always consists of at least four digits by padding with leading zeros
- * if needed.
- *
- * @param mask An integer representing the file permissions mask.
- *
- * Example:
- *   printMask(644);  // Output: 0644
- *   printMask(7);    // Output: 0007
+ * @param buffer Buffer where the histogram is written.
+ * @param size The capacity of the buffer.
+ * @param name The name of the metric.
+ * @param buckets The number of observations of each bucket.
+ * @param sum Pointer to the shared sum of the observations, in nanoseconds.
+ * @return The length of the histogram.
  */
-void printMask(const int mask)
+int histogram(char buffer[], const int size, const char *name, const unsigned long buckets[], const unsigned long *sum)
 {
-    int auxiliarMask;
-    int zeros;
-    int _;
+    unsigned long cumulative;
+    int length, index;
 
-    auxiliarMask = mask;
-    zeros = 4;
+    length = snprintf(buffer, size, "# TYPE %s histogram\n", name);
+    cumulative = 0;
 
-    // Calculate the number of leading zeros needed
-    while (auxiliarMask > 0)
+    for (index = 0; index < LATENCY_BUCKETS && length < size; index++)
     {
-        auxiliarMask = auxiliarMask / 10;
-        zeros--;
+        cumulative += __atomic_load_n(&buckets[index], __ATOMIC_RELAXED);
+
+        if (index < LATENCY_BUCKETS - 1)
+        {
+            length += snprintf(&buffer[length], size - length, "%s_bucket{le=\"%g\"} %lu\n", name, (double) ((long) LATENCY_BASE << index) / 1e9, cumulative);
+        }
+        else
+        {
+            length += snprintf(&buffer[length], size - length, "%s_bucket{le=\"+Inf\"} %lu\n", name, cumulative);
+        }
     }
 
-    // Print leading zeros
-    for (_ = 0; _ < zeros; _++)
+    if (length < size)
     {
-        printf("0");
+        length += snprintf(&buffer[length], size - length, "%s_sum %g\n%s_count %lu\n", name, (double) __atomic_load_n(sum, __ATOMIC_RELAXED) / 1e9, name, cumulative);
     }
 
-    printf("%i\n", mask);
+    return length < size ? length : size;
 }
 
 /**
- * Check if a given string represents a valid octal number.
+ * Read a monotonic clock.
  *
- * Ensure that the string is not NULL, has a length of at most 4 characters,
- * and each character represents a valid octal digit (0-7).
+ * @return The current time, in nanoseconds.
+ */
+long timestamp(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/**
+ * Record the time elapsed since an instant in a latency histogram, without
+ * locks.
  *
- * @param number The string to be checked for octal validity.
- * @return 1 if the string is a valid octal number, 0 otherwise.
+ * @param buckets The number of observations of each bucket.
+ * @param sum Pointer to the sum of the observations, in nanoseconds.
+ * @param start The instant, as returned by `timestamp`.
  */
-int octal(const char *number)
+void observe(unsigned long buckets[], unsigned long *sum, const long start)
 {
-    int length;
+    long elapsed;
     int index;
-    int mappedDigit;
 
-    if (number == NULL)
+    elapsed = timestamp() - start;
+
+    for (index = 0; index < LATENCY_BUCKETS - 1 && elapsed > (long) LATENCY_BASE << index; index++);
+
+    __atomic_fetch_add(&buckets[index], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(sum, elapsed, __ATOMIC_RELAXED);
+}
+
+/**
+ * Count the exit status of a process that has been waited for.
+ *
+ * @param metrics The counters, or NULL if metrics have never been enabled.
+ * @param status The status of the process reported by `waitpid`.
+ */
+void tally(tmetrics *metrics, const int status)
+{
+    if (metrics != NULL)
     {
-        return 0;
+        __atomic_fetch_add(&metrics->exits[exitStatus(status) % EXIT_STATUSES], 1, __ATOMIC_RELAXED);
     }
+}
 
-    length = strlen(number);
+/**
+ * Check if a job has completed.
+ *
+ * A job is considered finished when all of its commands have completed.
+ *
+ * @param job The structure representing the job.
+ * @param metrics The counters where exit statuses are counted, or NULL.
+ * @return 1 if all commands of the job have finished, 0 otherwise.
+ */
+int finished(tjob *job, tmetrics *metrics)
+{
+    int index;
+    int jobSize;
+    int pid;
+    int status;
 
-    if (length > 4)
+    if (job->finished == 1)
     {
-        return 0;
+        return 1;
     }
 
-    for (index = 0; index < length; index++)
+    jobSize = job->size;
+
+    for (index = 0; index < jobSize; index++)
     {
-        mappedDigit = number[index] - 48;
+        pid = job->pids[index];
 
-        if (mappedDigit < 0 || mappedDigit > 7)
+        if (!job->reaped[index] && waitpid(pid, &status, WNOHANG) == pid)
         {
-            return 0;
+            tally(metrics, status);
+            mark(job, index, status);
         }
     }
 
-    return 1;
+    return job->finished;
 }
 
 /**
- * Terminate all running processes associated with active jobs and exit the
- * shell.
+ * Mark a process of a job as waited for.
  *
- * Iterates through the list of active jobs, terminates each process within the
- * job, frees memory associated with the job list and exits the shell.
+ * The exit status of the job is the one of its last process, and the job is
+ * finished once all of its processes have been waited for.
+ *
+ * @param job The structure representing the job.
+ * @param index The index of the process within the job.
+ * @param status The status of the process reported by `waitpid`.
+ */
+void mark(tjob *job, const int index, const int status)
+{
+    job->reaped[index] = 1;
+    job->remaining--;
+
+    if (index == job->size - 1)
+    {
+        job->status = exitStatus(status);
+    }
+
+    job->finished = job->remaining == 0;
+}
+
+/**
+ * Record a process that has been waited for in the job it belongs to.
  *
  * @param jobs A pointer to the structure representing the list of active jobs.
+ * @param pid The process identifier.
+ * @param status The status of the process reported by `waitpid`.
+ * @return The index of the job of the process, or `NO_JOB` if it does not
+ * belong to any job.
  */
-void mshexit(tjobs *jobs)
+int record(tjobs *jobs, const pid_t pid, const int status)
 {
-    int j, pid;
-    int jobsSize, jobSize;
+    int j, index;
     tjob *job;
 
-    jobsSize = jobs->size;
-
-    for (j = 0; j < jobsSize; j++)
+    for (j = 0; j < jobs->size; j++)
     {
         job = &jobs->list[j];
-        jobSize = job->size;
 
-        for (pid = 0; pid < jobSize; pid++)
+        for (index = 0; index < job->size; index++)
         {
-            kill(job->pids[pid], KILL);
+            if (!job->reaped[index] && job->pids[index] == pid)
+            {
+                mark(job, index, status);
+                return j;
+            }
         }
     }
 
-    free(jobs->list);
-
-    exit(EXIT_SUCCESS);
+    return NO_JOB;
 }
 
 /**
- * Display the status of jobs in the provided job list.
- *
- * Checks the status of each job in the list and prints whether it is done or
- * running.
+ * Wait for any process of any job to terminate.
  *
- * If a job is done, it prints its completion status and saves it in
- * `finishedJobs` local variable to remove it later.
+ * Processes are collected in the order they terminate, whatever job they
+ * belong to, with a single blocking `waitpid`.
  *
  * @param jobs A pointer to the structure representing the list of active jobs.
+ * @return The index of the job of the terminated process, or `NO_JOB` if there
+ * are no processes left or the wait was interrupted by a signal.
  */
-void mshjobs(tjobs *jobs)
+int reap(tjobs *jobs)
 {
-    int j, jobsSize, formattedJ;
-    tjob *job;
-    int finishedJobs[MAXIMUM_JOB_LIST_SIZE];
-    int finishedJobsSize = 0;
-
-    jobsSize = jobs->size;
+    pid_t pid;
+    int status;
+    int job;
 
-    for (j = 0; j < jobsSize; j++)
+    do
     {
-        job = &jobs->list[j];
-
-        formattedJ = j + 1;
-
-        if (finished(job))
-        {
-            printf("[%i] Done\t%s", formattedJ, job->instruction);
+        pid = collect(jobs, -1, &status);
 
-            finishedJobs[finishedJobsSize] = j;
-            finishedJobsSize = (finishedJobsSize + 1) % MAXIMUM_JOB_LIST_SIZE;
-        }
-        else
+        if (pid == -1)
         {
-            printf("[%i] Running\t%s", formattedJ, job->instruction);
+            return NO_JOB;
         }
-    }
 
-    for (j = 0; j < finishedJobsSize; j++)
-    {
-        delete (finishedJobs[j], jobs);
-    }
+        job = record(jobs, pid, status);
+    } while (job == NO_JOB);
+
+    return job;
 }
 
 /**
- * Check if a job has completed.
+ * Wait for background jobs to finish and remove them from the list of active
+ * jobs.
  *
- * A job is considered finished when all of its commands have completed.
+ * Without arguments, waits for all jobs. With a job number, optionally
+ * preceded by `JOB_PREFIX`, waits for that job. With `NEXT_JOB`, waits for the
+ * first job to finish. Pressing `Ctrl+C` stops waiting, but not the jobs.
  *
- * @param job The structure representing the job.
- * @return 1 if all commands of the job have finished, 0 otherwise.
+ * @param arguments NULL terminated array of arguments.
+ * @param jobs A pointer to the structure representing the list of active jobs.
+ * @return The exit status of the job waited for, `EXIT_SUCCESS` when waiting
+ * for all jobs, `UNKNOWN_JOB_STATUS` if there is no job to wait for, or
+ * `SIGNAL_STATUS` plus `SIGINT` if the wait was interrupted.
  */
-int finished(tjob *job)
+int mshwait(char *arguments[], tjobs *jobs)
 {
-    int index;
-    int jobSize;
-    int pid;
-    int finished;
+    struct sigaction action, previous;
+    int job, j, reaped, status;
 
-    if (job->finished == 1)
+    job = NO_JOB;
+
+    if (arguments[0] != NULL && strcmp(arguments[0], NEXT_JOB) != 0)
     {
-        return 1;
+        job = atoi(&arguments[0][arguments[0][0] == JOB_PREFIX]) - 1;
+
+        if (job < 0 || job > jobs->size - 1)
+        {
+            fprintf(stderr, "wait: Error. No such job\n");
+            return UNKNOWN_JOB_STATUS;
+        }
     }
 
-    jobSize = job->size;
+    // Without `SA_RESTART`, `Ctrl+C` makes `waitpid` return
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = ctrlc2;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, &previous);
 
-    for (index = 0; index < jobSize; index++)
+    status = EXIT_SUCCESS;
+
+    if (job != NO_JOB)
     {
-        pid = job->pids[index];
+        while (!finished(&jobs->list[job], jobs->metrics) && reap(jobs) != NO_JOB)
+            ;
+    }
+    else if (arguments[0] != NULL)
+    {
+        for (j = 0; j < jobs->size && job == NO_JOB; j++)
+        {
+            job = finished(&jobs->list[j], jobs->metrics) ? j : NO_JOB;
+        }
 
-        finished = waitpid(pid, NULL, WNOHANG) == pid;
+        while (job == NO_JOB && (reaped = reap(jobs)) != NO_JOB)
+        {
+            job = jobs->list[reaped].finished ? reaped : NO_JOB;
+        }
 
-        if (!finished)
+        if (job == NO_JOB)
         {
-            return 0;
+            status = jobs->size == 0 ? UNKNOWN_JOB_STATUS : SIGNAL_STATUS + SIGINT;
         }
     }
+    else
+    {
+        while (reap(jobs) != NO_JOB)
+            ;
 
-    job->finished = 1;
+        status = errno == EINTR ? SIGNAL_STATUS + SIGINT : EXIT_SUCCESS;
 
-    return 1;
+        // Delete backwards so the indices of the remaining jobs do not shift
+        for (j = jobs->size - 1; j >= 0; j--)
+        {
+            if (finished(&jobs->list[j], jobs->metrics))
+            {
+                delete (j, jobs);
+            }
+        }
+    }
+
+    if (job != NO_JOB)
+    {
+        if (finished(&jobs->list[job], jobs->metrics))
+        {
+            status = jobs->list[job].status;
+            delete (job, jobs);
+        }
+        else
+        {
+            status = SIGNAL_STATUS + SIGINT;
+        }
+    }
+
+    sigaction(SIGINT, &previous, NULL);
+
+    return status;
 }
 
 /**
@@ -800,6 +5759,7 @@ void mshfg(const char *job, tjobs *jobs)
     tjob *ranJob;
     int jobSize;
     int index;
+    int status;
 
     if (job == NULL)
     {
@@ -825,7 +5785,7 @@ void mshfg(const char *job, tjobs *jobs)
 
     ranJob = &jobs->list[mappedJob];
 
-    if (finished(ranJob))
+    if (finished(ranJob, jobs->metrics))
     {
         printf("fg: job has terminated\n");
         printf("[%s] Done\t%s", job, ranJob->instruction);
@@ -838,7 +5798,10 @@ void mshfg(const char *job, tjobs *jobs)
 
         for (index = 0; index < jobSize; index++)
         {
-            waitpid(ranJob->pids[index], NULL, WAIT);
+            if (!ranJob->reaped[index] && collect(jobs, ranJob->pids[index], &status) == ranJob->pids[index])
+            {
+                mark(ranJob, index, status);
+            }
         }
     }
 
@@ -850,21 +5813,38 @@ void mshfg(const char *job, tjobs *jobs)
 /**
  * Delete a inactive job from a list of active jobs.
  *
+ * Its remaining captured output is written to the terminal before its buffers
+ * are freed.
+ *
  * @param job Inactive job that will be removed from active jobs list.
  * @param jobs A pointer to the structure representing the list of active jobs.
  */
 void delete(const int job, tjobs *jobs)
 {
     int index, jobsSize;
+    tjob *deleted;
+
+    deleted = &jobs->list[job];
+
+    drain(deleted);
+
+    if (deleted->output != NO_OUTPUT)
+    {
+        flushOutput(deleted);
+        close(deleted->output);
+    }
+
+    free(deleted->tail);
+    free(deleted->line);
 
     jobsSize = jobs->size;
 
-    for (index = job; index < jobsSize; index++)
+    for (index = job; index < jobsSize - 1; index++)
     {
         jobs->list[index] = jobs->list[index + 1];
     }
 
-    jobs->size = (jobs->size - 1) % MAXIMUM_JOB_LIST_SIZE;
+    jobs->size--;
 }
 
 /**